@@ -0,0 +1,181 @@
+/* Runs two cubes through the recognizer and the published-code filter the
+ * way the firmware does, and checks that each one is published once.
+ *
+ *   multi_code_test
+ *
+ * The recognizer is set up like qrcode_session_prepare() for an SVGA
+ * camera, with tracking, the coarse pass and the region of interest. Cube
+ * A is shown alone, then cube B arrives elsewhere in the region, then
+ * nothing decodes for a few frames, then A leaves for long enough to be
+ * forgotten and comes back. Both codes have to decode in every frame they
+ * are drawn in, A has to be published twice and B once. The exit status
+ * is 1 otherwise.
+ */
+
+#include "../pipeline/seen_codes.h"
+#include "../quirc/quirc.h"
+#include "qr_synth.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MULTI_W                  800
+#define MULTI_H                  600
+#define MULTI_MODULE             4
+#define MULTI_VERSION            2
+#define MULTI_CODES              2
+#define MULTI_PIXELS_PER_REGION  256
+#define MULTI_FLOOD_FILL_REGIONS 254
+#define MULTI_RUN_TABLE_BYTES    (1024 * 1024)
+
+static const char* const payloads[MULTI_CODES] = {"cube-A", "cube-B"};
+
+/* Top-left corner of each code, quiet zone excluded, inside the region of
+ * interest. A frame lists which codes are drawn.
+ */
+static const int positions[MULTI_CODES][2] = {{250, 160}, {440, 320}};
+
+struct multi_frame {
+  bool drawn[MULTI_CODES];
+};
+
+static const multi_frame frames[] = {
+    {{true, false}},  {{true, false}}, {{true, true}},   {{true, true}},   {{false, false}}, {{false, false}},
+    {{false, true}},  {{false, true}}, {{false, true}},  {{false, true}},  {{false, true}},  {{true, true}},
+    {{true, true}},
+};
+
+#define MULTI_FRAMES ((int)(sizeof(frames) / sizeof(frames[0])))
+
+// expected publishes in order
+static const int expected[] = {0, 1, 0};
+
+#define MULTI_EXPECTED ((int)(sizeof(expected) / sizeof(expected[0])))
+
+static uint8_t grids[MULTI_CODES][QR_SYNTH_MAX_SIZE * QR_SYNTH_MAX_SIZE];
+static uint8_t frame[MULTI_W * MULTI_H];
+
+static void draw_frame(const multi_frame* f, int size) {
+  memset(frame, 200, sizeof(frame));
+  for (int i = 0; i < MULTI_CODES; i++) {
+    if (!f->drawn[i]) {
+      continue;
+    }
+    for (int y = 0; y < size * MULTI_MODULE; y++) {
+      for (int x = 0; x < size * MULTI_MODULE; x++) {
+        if (grids[i][(y / MULTI_MODULE) * size + x / MULTI_MODULE]) {
+          frame[(positions[i][1] + y) * MULTI_W + positions[i][0] + x] = 40;
+        }
+      }
+    }
+  }
+}
+
+static int payload_index(const quirc_data* data) {
+  for (int i = 0; i < MULTI_CODES; i++) {
+    if (data->payload_len == (int)strlen(payloads[i]) && !memcmp(data->payload, payloads[i], data->payload_len)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Same order of setup as qrcode_session_prepare() in the firmware */
+static struct quirc* prepare() {
+  struct quirc* q = quirc_new();
+  if (q == NULL) {
+    return NULL;
+  }
+
+  quirc_set_packed_scan(q, 1);
+  quirc_set_max_run_bytes(q, MULTI_RUN_TABLE_BYTES);
+  quirc_set_threshold(q, QUIRC_THRESHOLD_BOX);
+  quirc_set_tracking(q, 1);
+  if (quirc_set_pyramid(q, 2) < 0 || quirc_resize(q, MULTI_W, MULTI_H) < 0) {
+    quirc_destroy(q);
+    return NULL;
+  }
+
+  int roi_w = MULTI_W * 4000 / 10000;
+  int roi_h = MULTI_H * 5000 / 10000;
+  int max_regions = roi_w * roi_h / MULTI_PIXELS_PER_REGION;
+  // runs only where flood filling would run out of regions
+  if (max_regions > MULTI_FLOOD_FILL_REGIONS
+      && (quirc_set_run_labels(q, 1) < 0 || quirc_set_max_regions(q, max_regions) < 0)) {
+    quirc_destroy(q);
+    return NULL;
+  }
+  quirc_set_roi(q, MULTI_W * 2948 / 10000, MULTI_H * 2431 / 10000, roi_w, roi_h);
+  return q;
+}
+
+int main() {
+  static quirc_code code;
+  static quirc_data data;
+  static quirc_decode_scratch scratch;
+  SeenCodes seen;
+  int published[MULTI_FRAMES * MULTI_CODES];
+  int num_published = 0;
+  int failed = 0;
+  int size = 0;
+
+  for (int i = 0; i < MULTI_CODES; i++) {
+    size = qr_synth_encode((const uint8_t*)payloads[i], strlen(payloads[i]), MULTI_VERSION, 0, 0, grids[i]);
+    if (size < 0) {
+      fprintf(stderr, "can't encode the test codes\n");
+      return 1;
+    }
+  }
+
+  struct quirc* q = prepare();
+  if (q == NULL) {
+    fprintf(stderr, "can't set up the recognizer\n");
+    return 1;
+  }
+
+  for (int f = 0; f < MULTI_FRAMES; f++) {
+    bool decoded_code[MULTI_CODES] = {false};
+    int decoded = 0;
+
+    draw_frame(&frames[f], size);
+    quirc_begin_borrowed(q, frame);
+    quirc_end(q);
+
+    seen.begin_frame();
+    for (int i = 0; i < quirc_count(q); i++) {
+      quirc_extract(q, i, &code);
+      if (quirc_decode_with_scratch(&code, &data, &scratch)) {
+        continue;
+      }
+      decoded++;
+
+      int index = payload_index(&data);
+      if (index >= 0) {
+        decoded_code[index] = true;
+      }
+      if (seen.is_new(data.payload, data.payload_len)) {
+        printf("frame %d: published \"%s\"\n", f, (const char*)data.payload);
+        published[num_published++] = index;
+      }
+      seen.mark(data.payload, data.payload_len);
+    }
+    seen.end_frame(decoded);
+
+    for (int i = 0; i < MULTI_CODES; i++) {
+      if (frames[f].drawn[i] && !decoded_code[i]) {
+        printf("FAIL: frame %d: code \"%s\" not decoded, %d grids found\n", f, payloads[i], quirc_count(q));
+        failed = 1;
+      }
+    }
+  }
+  quirc_destroy(q);
+
+  if (num_published != MULTI_EXPECTED || memcmp(published, expected, sizeof(expected))) {
+    printf("FAIL: %d publishes, expected A, B, then A again\n", num_published);
+    failed = 1;
+  }
+  if (!failed) {
+    printf("every cube decoded in every frame and published once per visit\n");
+  }
+  return failed;
+}
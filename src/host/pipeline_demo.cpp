@@ -0,0 +1,93 @@
+/* Runs the capture/decode/stream graph on the host with synthetic frames.
+ *
+ *   pipeline_demo [seconds] [decode_ms] [stream_ms] [buffers]
+ *
+ * The sinks only sleep, to stand in for a slow decoder and a slow client,
+ * and check that every frame they get is newer than the one before. A
+ * stream_ms of 0 runs without a viewer. The scene stops moving halfway
+ * through, so the second half shows the idle rate and the frames that
+ * were not decoded because nothing changed. Until then the decoder has
+ * to be given PIPELINE_DECODE_FRAMES more frames, or as many as it can
+ * take in three quarters of that half, however fast capture runs.
+ *
+ * The source lends out the given number of buffers, 3 by default, as the
+ * camera driver does with its framebuffers, and every one of them has to
+ * be back once the pipeline stopped. With 0 every frame is copied.
+ */
+
+#include "../pipeline/pipeline.h"
+#include "../pipeline/synthetic_source.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+class SleepingSink : public FrameSink
+{
+public:
+  SleepingSink(int busy_ms, bool wants) : busy_ms_(busy_ms), wants_(wants), last_seq_(-1), out_of_order_(0) {}
+
+  bool wants_frames() override { return wants_; }
+
+  void consume(const Frame& frame) override {
+    if ((long)frame.seq <= last_seq_) {
+      out_of_order_++;
+    }
+    last_seq_ = frame.seq;
+    std::this_thread::sleep_for(std::chrono::milliseconds(busy_ms_));
+  }
+
+  int out_of_order() const { return out_of_order_; }
+
+private:
+  int busy_ms_;
+  bool wants_;
+  long last_seq_;
+  int out_of_order_;
+};
+
+int main(int argc, char** argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 3;
+  int decode_ms = argc > 2 ? atoi(argv[2]) : 80;
+  int stream_ms = argc > 3 ? atoi(argv[3]) : 20;
+  int buffers = argc > 4 ? atoi(argv[4]) : 3;
+
+  SyntheticFrameSource source(320, 240, 25, buffers);
+  SleepingSink decoder(decode_ms, true);
+  SleepingSink streamer(stream_ms, stream_ms > 0);
+  FramePipeline pipeline(source, decoder, streamer);
+  const PipelineStats& stats = pipeline.stats();
+
+  pipeline.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 500));
+  unsigned moving = stats.captured;
+  unsigned decoded_moving = stats.decoded;
+  source.set_moving(false);
+  std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 500));
+  pipeline.stop();
+  unsigned decoded_still = stats.decoded - decoded_moving;
+  unsigned expected_still = decode_ms > 0 ? seconds * 375 / decode_ms : PIPELINE_DECODE_FRAMES;
+  if (expected_still > PIPELINE_DECODE_FRAMES) {
+    expected_still = PIPELINE_DECODE_FRAMES;
+  }
+
+  printf("captured %u moving, %u still (%u idle)\n", moving, (unsigned)stats.captured - moving,
+         (unsigned)stats.idle_frames);
+  printf("decoded %u (dropped %u, skipped %u), streamed %u (dropped %u), pool exhausted %u\n",
+         (unsigned)stats.decoded, (unsigned)stats.decode_dropped, (unsigned)stats.decode_skipped,
+         (unsigned)stats.streamed, (unsigned)stats.stream_dropped, (unsigned)stats.pool_exhausted);
+
+  if (decoder.out_of_order() || streamer.out_of_order()) {
+    printf("frames delivered out of order\n");
+    return 1;
+  }
+  if (decoded_still < expected_still) {
+    printf("only %u frames decoded after the scene stopped, expected %u\n", decoded_still, expected_still);
+    return 1;
+  }
+  if (source.lent()) {
+    printf("%d buffers not given back to the source\n", source.lent());
+    return 1;
+  }
+  return 0;
+}
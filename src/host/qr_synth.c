@@ -0,0 +1,618 @@
+/* Synthetic QR codes for benchmarks. The encoder only knows byte mode,
+ * which is all the cube labels use. Everything it needs, the version
+ * tables included, is written out here from the standard, so that the
+ * codes don't depend on the code under test.
+ */
+
+#include "qr_synth.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QR_SYNTH_QUIET 4
+
+#define QR_SYNTH_MAX_VERSION   40
+#define QR_SYNTH_MAX_CODEWORDS 3706
+#define QR_SYNTH_MAX_ALIGNMENT 7
+
+/************************************************************************
+ * Version tables
+ */
+
+/* Error correction codewords per block and number of blocks, from the
+ * tables of ISO/IEC 18004. Rows are in the order of the ECC level in
+ * the format bits: M, L, H, Q.
+ */
+static const uint8_t ecc_block_len[4][QR_SYNTH_MAX_VERSION + 1] = {
+    {0,  10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22, 24, 24, 28, 28, 26, 26, 26,
+     26, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28},
+    {0,  7,  10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26, 30, 22, 24, 28, 30, 28, 28,
+     28, 28, 30, 30, 26, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {0,  17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22, 24, 24, 30, 28, 28, 26, 28,
+     30, 24, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {0,  13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24, 20, 30, 24, 28, 28, 26, 30,
+     28, 30, 30, 30, 30, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+};
+
+static const uint8_t ecc_blocks[4][QR_SYNTH_MAX_VERSION + 1] = {
+    {0,  1,  1,  1,  2,  2,  4,  4,  4,  5,  5,  5,  8,  9,  9,  10, 10, 11, 13, 14, 16,
+     17, 17, 18, 20, 21, 23, 25, 26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49},
+    {0,  1,  1,  1,  1,  1,  2,  2,  2,  2,  4,  4,  4,  4,  4,  6,  6,  6,  6,  7,  8,
+     8,  9,  9,  10, 12, 12, 12, 13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25},
+    {0,  1,  1,  2,  4,  4,  4,  5,  6,  8,  8,  11, 11, 16, 16, 18, 16, 19, 21, 25, 25,
+     25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},
+    {0,  1,  1,  2,  2,  4,  4,  6,  6,  8,  8,  8,  10, 12, 16, 12, 17, 16, 18, 21, 20,
+     23, 23, 25, 27, 29, 34, 34, 35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68},
+};
+
+/* Alignment pattern centres along either axis. They start at 6, end 7
+ * modules from the far edge and are evenly spaced in between, an even
+ * number of modules apart, with any slack in the first gap.
+ */
+static int alignment_positions(int version, int* pos) {
+  int n, step, i;
+
+  if (version < 2) {
+    return 0;
+  }
+
+  n = version / 7 + 2;
+  step = (version * 8 + n * 3 + 5) / (n * 4 - 4) * 2;
+  pos[0] = 6;
+  for (i = n - 1; i > 0; i--) {
+    pos[i] = version * 4 + 10 - (n - 1 - i) * step;
+  }
+  return n;
+}
+
+/* Codewords in a code: the modules left once the function patterns
+ * and the format and version areas are taken out, in whole bytes
+ */
+static int total_codewords(int version) {
+  int modules = (16 * version + 128) * version + 64;
+
+  if (version >= 2) {
+    int n = version / 7 + 2;
+
+    modules -= (25 * n - 10) * n - 55;
+  }
+  if (version >= 7) {
+    modules -= 36;
+  }
+  return modules / 8;
+}
+
+/************************************************************************
+ * Encoder
+ */
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+
+static void gf_init(void) {
+  int x = 1;
+  int i;
+
+  for (i = 0; i < 255; i++) {
+    gf_exp[i] = gf_exp[i + 255] = x;
+    gf_log[x] = i;
+    x <<= 1;
+    if (x & 0x100) {
+      x ^= 0x11d;
+    }
+  }
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) { return a && b ? gf_exp[gf_log[a] + gf_log[b]] : 0; }
+
+/* Parity bytes of a block, for the generator with roots alpha^0 onwards */
+static void rs_encode(const uint8_t* data, int dw, int npar, uint8_t* parity) {
+  uint8_t gen[256] = {1};
+  int i, j;
+
+  if (npar <= 0 || npar > 255) {
+    return;
+  }
+
+  for (i = 0; i < npar; i++) {
+    for (j = i + 1; j > 0; j--) {
+      gen[j] = gen[j - 1] ^ gf_mul(gen[j], gf_exp[i]);
+    }
+    gen[0] = gf_mul(gen[0], gf_exp[i]);
+  }
+
+  memset(parity, 0, npar);
+  for (i = 0; i < dw; i++) {
+    uint8_t f = data[i] ^ parity[0];
+
+    memmove(parity, parity + 1, npar - 1);
+    parity[npar - 1] = 0;
+    for (j = 0; j < npar; j++) {
+      parity[j] ^= gf_mul(gen[npar - 1 - j], f);
+    }
+  }
+}
+
+static int mask_bit(int mask, int i, int j) {
+  switch (mask) {
+  case 0:
+    return !((i + j) % 2);
+  case 1:
+    return !(i % 2);
+  case 2:
+    return !(j % 3);
+  case 3:
+    return !((i + j) % 3);
+  case 4:
+    return !(((i / 2) + (j / 3)) % 2);
+  case 5:
+    return !((i * j) % 2 + (i * j) % 3);
+  case 6:
+    return !(((i * j) % 2 + (i * j) % 3) % 2);
+  default:
+    return !(((i * j) % 3 + (i + j) % 2) % 2);
+  }
+}
+
+/* BCH code of the given data bits, appended to them */
+static int bch_code(int data, int data_bits, int poly, int poly_bits) {
+  int v = data << (poly_bits - 1);
+  int i;
+
+  for (i = data_bits + poly_bits - 2; i >= poly_bits - 1; i--) {
+    if (v & (1 << i)) {
+      v ^= poly << (i - poly_bits + 1);
+    }
+  }
+
+  return (data << (poly_bits - 1)) | v;
+}
+
+static void put_bits(uint8_t* buf, int* pos, int value, int n) {
+  while (n--) {
+    if ((value >> n) & 1) {
+      buf[*pos >> 3] |= 0x80 >> (*pos & 7);
+    }
+    (*pos)++;
+  }
+}
+
+/* Function patterns are drawn with 2 for white and 3 for black, so that
+ * data placement can tell them from free modules.
+ */
+static void put_module(uint8_t* grid, int size, int x, int y, int black) { grid[y * size + x] = 2 + !!black; }
+
+static void draw_function_patterns(uint8_t* grid, int version, int size) {
+  int apat[QR_SYNTH_MAX_ALIGNMENT];
+  int n = alignment_positions(version, apat);
+  int i, j, x, y;
+
+  /* Finders with their separators, then the format areas */
+  for (i = 0; i < 3; i++) {
+    int cx = i == 1 ? size - 4 : 3;
+    int cy = i == 2 ? size - 4 : 3;
+
+    for (y = -4; y <= 4; y++) {
+      for (x = -4; x <= 4; x++) {
+        int d = abs(x) > abs(y) ? abs(x) : abs(y);
+
+        if (cx + x >= 0 && cx + x < size && cy + y >= 0 && cy + y < size) {
+          put_module(grid, size, cx + x, cy + y, d != 2 && d != 4);
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < 9; i++) {
+    put_module(grid, size, 8, i, 0);
+    put_module(grid, size, i, 8, 0);
+    if (i < 8) {
+      put_module(grid, size, 8, size - 1 - i, 0);
+      put_module(grid, size, size - 1 - i, 8, 0);
+    }
+  }
+
+  /* Timing patterns */
+  for (i = 8; i < size - 8; i++) {
+    put_module(grid, size, i, 6, !(i & 1));
+    put_module(grid, size, 6, i, !(i & 1));
+  }
+
+  /* Alignment patterns, except where they would overlap the finders */
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < n; j++) {
+      if ((i == 0 && j == 0) || (i == 0 && j == n - 1) || (i == n - 1 && j == 0)) {
+        continue;
+      }
+      for (y = -2; y <= 2; y++) {
+        for (x = -2; x <= 2; x++) {
+          int d = abs(x) > abs(y) ? abs(x) : abs(y);
+
+          put_module(grid, size, apat[j] + x, apat[i] + y, d != 1);
+        }
+      }
+    }
+  }
+
+  /* Version information */
+  if (version >= 7) {
+    int v = bch_code(version, 6, 0x1f25, 13);
+
+    for (i = 0; i < 18; i++) {
+      int b = (v >> i) & 1;
+
+      put_module(grid, size, size - 11 + i % 3, i / 3, b);
+      put_module(grid, size, i / 3, size - 11 + i % 3, b);
+    }
+  }
+
+  put_module(grid, size, 8, size - 8, 1);
+}
+
+static void draw_format(uint8_t* grid, int size, int ecc_level, int mask) {
+  static const int xs[15] = {8, 8, 8, 8, 8, 8, 8, 8, 7, 5, 4, 3, 2, 1, 0};
+  static const int ys[15] = {0, 1, 2, 3, 4, 5, 7, 8, 8, 8, 8, 8, 8, 8, 8};
+  int v = bch_code((ecc_level << 3) | mask, 5, 0x537, 11) ^ 0x5412;
+  int i;
+
+  for (i = 0; i < 15; i++) {
+    put_module(grid, size, xs[i], ys[i], (v >> i) & 1);
+  }
+  for (i = 0; i < 7; i++) {
+    put_module(grid, size, 8, size - 1 - i, (v >> (14 - i)) & 1);
+  }
+  for (i = 0; i < 8; i++) {
+    put_module(grid, size, size - 8 + i, 8, (v >> (7 - i)) & 1);
+  }
+}
+
+int qr_synth_encode(const uint8_t* payload, int len, int version, int ecc_level, int mask, uint8_t* grid) {
+  uint8_t data[QR_SYNTH_MAX_CODEWORDS];
+  uint8_t raw[QR_SYNTH_MAX_CODEWORDS];
+  uint8_t parity[256];
+  int offsets[256];
+  int size, total, blocks, short_blocks, short_dw, ndata, npar, count_bits;
+  int pos = 0;
+  int i, j, k, x, y, dir;
+
+  if (version < 1 || version > QR_SYNTH_MAX_VERSION || ecc_level < 0 || ecc_level > 3 || mask < 0 || mask > 7) {
+    return -1;
+  }
+
+  /* Blocks that don't divide the codewords evenly have one more data
+   * codeword each, and come last
+   */
+  size = version * 4 + 17;
+  total = total_codewords(version);
+  blocks = ecc_blocks[ecc_level][version];
+  npar = ecc_block_len[ecc_level][version];
+  short_blocks = blocks - total % blocks;
+  short_dw = total / blocks - npar;
+  ndata = total - npar * blocks;
+  count_bits = version < 10 ? 8 : 16;
+
+  if (4 + count_bits + len * 8 > ndata * 8) {
+    return -1;
+  }
+  if (!gf_exp[0]) {
+    gf_init();
+  }
+
+  /* Byte mode segment, terminator and pad codewords */
+  memset(data, 0, sizeof(data));
+  put_bits(data, &pos, 4, 4);
+  put_bits(data, &pos, len, count_bits);
+  for (i = 0; i < len; i++) {
+    put_bits(data, &pos, payload[i], 8);
+  }
+  pos = (pos + 4 <= ndata * 8 ? pos + 4 : ndata * 8);
+  for (i = (pos + 7) >> 3; i < ndata; i++) {
+    data[i] = (i - ((pos + 7) >> 3)) & 1 ? 0x11 : 0xec;
+  }
+
+  /* Interleave the data codewords of the blocks, then their parity */
+  for (i = 0, j = 0; i < blocks; i++) {
+    offsets[i] = j;
+    j += short_dw + (i >= short_blocks);
+  }
+  k = 0;
+  for (j = 0; j <= short_dw; j++) {
+    for (i = 0; i < blocks; i++) {
+      if (j < short_dw + (i >= short_blocks)) {
+        raw[k++] = data[offsets[i] + j];
+      }
+    }
+  }
+  for (i = 0; i < blocks; i++) {
+    rs_encode(data + offsets[i], short_dw + (i >= short_blocks), npar, parity);
+    for (j = 0; j < npar; j++) {
+      raw[k + j * blocks + i] = parity[j];
+    }
+  }
+
+  memset(grid, 0, size * size);
+  draw_function_patterns(grid, version, size);
+  draw_format(grid, size, ecc_level, mask);
+
+  /* Data modules in the zigzag order, masked */
+  x = y = size - 1;
+  dir = -1;
+  pos = 0;
+  while (x > 0) {
+    if (x == 6) {
+      x--;
+    }
+    for (k = 0; k < 2; k++) {
+      uint8_t* m = &grid[y * size + x - k];
+
+      if (!*m) {
+        int b = pos < total * 8 ? (raw[pos >> 3] >> (7 - (pos & 7))) & 1 : 0;
+
+        *m = b ^ mask_bit(mask, y, x - k);
+        pos++;
+      }
+    }
+    y += dir;
+    if (y < 0 || y >= size) {
+      dir = -dir;
+      x -= 2;
+      y += dir;
+    }
+  }
+
+  for (i = 0; i < size * size; i++) {
+    grid[i] &= 1;
+  }
+
+  return size;
+}
+
+/************************************************************************
+ * Renderer
+ */
+
+static uint32_t rng_next(uint32_t* state) {
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x ? x : 0x9e3779b9;
+}
+
+/* Uniform in [lo, hi) */
+static float rng_range(uint32_t* state, float lo, float hi) {
+  return lo + (hi - lo) * (rng_next(state) >> 8) / 16777216.0f;
+}
+
+/* Projective map taking the unit square to a quadrilateral, corners in
+ * the order (0,0), (1,0), (1,1), (0,1)
+ */
+static void square_to_quad(const float* qx, const float* qy, double* m) {
+  double sx = qx[0] - qx[1] + qx[2] - qx[3];
+  double sy = qy[0] - qy[1] + qy[2] - qy[3];
+  double dx1 = qx[1] - qx[2], dx2 = qx[3] - qx[2];
+  double dy1 = qy[1] - qy[2], dy2 = qy[3] - qy[2];
+  double den = dx1 * dy2 - dx2 * dy1;
+  double g = (sx * dy2 - dx2 * sy) / den;
+  double h = (dx1 * sy - sx * dy1) / den;
+
+  m[0] = qx[1] - qx[0] + g * qx[1];
+  m[1] = qx[3] - qx[0] + h * qx[3];
+  m[2] = qx[0];
+  m[3] = qy[1] - qy[0] + g * qy[1];
+  m[4] = qy[3] - qy[0] + h * qy[3];
+  m[5] = qy[0];
+  m[6] = g;
+  m[7] = h;
+  m[8] = 1;
+}
+
+static void invert3(const double* m, double* r) {
+  r[0] = m[4] * m[8] - m[5] * m[7];
+  r[1] = m[2] * m[7] - m[1] * m[8];
+  r[2] = m[1] * m[5] - m[2] * m[4];
+  r[3] = m[5] * m[6] - m[3] * m[8];
+  r[4] = m[0] * m[8] - m[2] * m[6];
+  r[5] = m[2] * m[3] - m[0] * m[5];
+  r[6] = m[3] * m[7] - m[4] * m[6];
+  r[7] = m[1] * m[6] - m[0] * m[7];
+  r[8] = m[0] * m[4] - m[1] * m[3];
+}
+
+static void fill_rect(uint8_t* frame, int w, int h, int x, int y, int rw, int rh, uint8_t v) {
+  int i;
+
+  if (x < 0) {
+    rw += x;
+    x = 0;
+  }
+  if (y < 0) {
+    rh += y;
+    y = 0;
+  }
+  if (x + rw > w) {
+    rw = w - x;
+  }
+  if (y + rh > h) {
+    rh = h - y;
+  }
+  for (i = 0; i < rh; i++) {
+    memset(frame + (y + i) * w + x, v, rw > 0 ? rw : 0);
+  }
+}
+
+/* Barcode-like groups of bars and solid blocks, at about the module size */
+static void draw_clutter(const struct qr_synth_scene* scene, float module, uint32_t* rng, uint8_t* frame, int w,
+                         int h) {
+  int i;
+
+  for (i = 0; i < scene->clutter; i++) {
+    int x = rng_next(rng) % w;
+    int y = rng_next(rng) % h;
+    uint8_t dark = 20 + rng_next(rng) % 50;
+
+    if (i & 1) {
+      int bars = 4 + rng_next(rng) % 12;
+      int height = (int)(module * rng_range(rng, 4, 12));
+      int b;
+
+      for (b = 0; b < bars; b++) {
+        int bar = (int)(module * (1 + rng_next(rng) % 4) / 2) + 1;
+
+        fill_rect(frame, w, h, x, y, bar, height, dark);
+        x += bar + (int)(module * (1 + rng_next(rng) % 3) / 2) + 1;
+      }
+    } else {
+      fill_rect(frame, w, h, x, y, (int)(module * rng_range(rng, 1, 6)) + 1, (int)(module * rng_range(rng, 1, 6)) + 1,
+                dark);
+    }
+  }
+}
+
+static int clamp_index(int i, int len) { return i < 0 ? 0 : i >= len ? len - 1 : i; }
+
+/* Separable box blur, in place. Edge pixels are repeated outwards. */
+static int box_blur(uint8_t* frame, int w, int h, int r) {
+  uint8_t* tmp = malloc(w > h ? w : h);
+  int pass, i, j;
+
+  if (!tmp) {
+    return -1;
+  }
+
+  for (pass = 0; pass < 2; pass++) {
+    int lines = pass ? w : h;
+    int len = pass ? h : w;
+    int step = pass ? w : 1;
+    int stride = pass ? 1 : w;
+
+    for (i = 0; i < lines; i++) {
+      uint8_t* line = frame + i * stride;
+      int sum = 0;
+
+      for (j = -r; j <= r; j++) {
+        sum += line[clamp_index(j, len) * step];
+      }
+      for (j = 0; j < len; j++) {
+        tmp[j] = sum / (2 * r + 1);
+        sum += line[clamp_index(j + r + 1, len) * step] - line[clamp_index(j - r, len) * step];
+      }
+      for (j = 0; j < len; j++) {
+        line[j * step] = tmp[j];
+      }
+    }
+  }
+
+  free(tmp);
+  return 0;
+}
+
+int qr_synth_render(const uint8_t* grid, int size, const struct qr_synth_scene* scene, uint32_t* rng, uint8_t* frame,
+                    int w, int h) {
+  const int span = size + 2 * QR_SYNTH_QUIET;
+  const int short_side = w < h ? w : h;
+  float module = scene->fill * short_side / size;
+  float side, margin, cx, cy, angle;
+  float qx[4], qy[4];
+  double to_frame[9], to_code[9];
+  float light_dx, light_dy, light_max;
+  int x0 = w, y0 = h, x1 = 0, y1 = 0;
+  int i, x, y;
+
+  if (module < scene->min_module) {
+    module = scene->min_module;
+  }
+  side = module * size;
+  margin = module * span * (0.5f + scene->perspective) * 1.42f;
+  if (2 * margin > short_side) {
+    margin = module * span * (0.5f + scene->perspective);
+    if (2 * margin > short_side) {
+      return -1;
+    }
+  }
+
+  /* Background with clutter, the code with its quiet zone on top */
+  memset(frame, 150 + rng_next(rng) % 60, w * h);
+  draw_clutter(scene, module, rng, frame, w, h);
+
+  cx = rng_range(rng, margin, w - margin);
+  cy = rng_range(rng, margin, h - margin);
+  angle = rng_range(rng, 0, 2 * M_PI);
+  for (i = 0; i < 4; i++) {
+    float u = (i == 1 || i == 2) ? 0.5f : -0.5f;
+    float v = i >= 2 ? 0.5f : -0.5f;
+
+    qx[i] = cx + side * (u * cosf(angle) - v * sinf(angle)) + side * rng_range(rng, -1, 1) * scene->perspective;
+    qy[i] = cy + side * (u * sinf(angle) + v * cosf(angle)) + side * rng_range(rng, -1, 1) * scene->perspective;
+  }
+  square_to_quad(qx, qy, to_frame);
+  invert3(to_frame, to_code);
+
+  /* Bounding box of the quiet zone */
+  for (i = 0; i < 4; i++) {
+    float u = ((i == 1 || i == 2) ? span : 0) - QR_SYNTH_QUIET;
+    float v = (i >= 2 ? span : 0) - QR_SYNTH_QUIET;
+    double px = to_frame[0] * u / size + to_frame[1] * v / size + to_frame[2];
+    double py = to_frame[3] * u / size + to_frame[4] * v / size + to_frame[5];
+    double pw = to_frame[6] * u / size + to_frame[7] * v / size + to_frame[8];
+
+    px /= pw;
+    py /= pw;
+    x0 = px < x0 ? (int)px : x0;
+    y0 = py < y0 ? (int)py : y0;
+    x1 = px + 1 > x1 ? (int)px + 1 : x1;
+    y1 = py + 1 > y1 ? (int)py + 1 : y1;
+  }
+  x0 = x0 < 0 ? 0 : x0;
+  y0 = y0 < 0 ? 0 : y0;
+  x1 = x1 > w ? w : x1;
+  y1 = y1 > h ? h : y1;
+
+  {
+    uint8_t dark = 20 + rng_next(rng) % 40;
+    uint8_t light = 190 + rng_next(rng) % 50;
+
+    for (y = y0; y < y1; y++) {
+      for (x = x0; x < x1; x++) {
+        double pw = to_code[6] * (x + 0.5) + to_code[7] * (y + 0.5) + to_code[8];
+        double u = (to_code[0] * (x + 0.5) + to_code[1] * (y + 0.5) + to_code[2]) / pw * size;
+        double v = (to_code[3] * (x + 0.5) + to_code[4] * (y + 0.5) + to_code[5]) / pw * size;
+
+        if (u < -QR_SYNTH_QUIET || v < -QR_SYNTH_QUIET || u >= size + QR_SYNTH_QUIET || v >= size + QR_SYNTH_QUIET) {
+          continue;
+        }
+        if (u >= 0 && v >= 0 && u < size && v < size && grid[(int)v * size + (int)u]) {
+          frame[y * w + x] = dark;
+        } else {
+          frame[y * w + x] = light;
+        }
+      }
+    }
+  }
+
+  if (scene->blur > 0 && box_blur(frame, w, h, scene->blur) < 0) {
+    return -1;
+  }
+
+  /* Light falls off linearly in a random direction, then noise */
+  angle = rng_range(rng, 0, 2 * M_PI);
+  light_dx = cosf(angle);
+  light_dy = sinf(angle);
+  light_max = fabsf(light_dx) * w + fabsf(light_dy) * h;
+  for (y = 0; y < h; y++) {
+    for (x = 0; x < w; x++) {
+      float along = (light_dx * x + light_dy * y + (light_dx < 0 ? -light_dx * w : 0) + (light_dy < 0 ? -light_dy * h : 0))
+                    / light_max;
+      int v = frame[y * w + x] * (1.0f - scene->lighting / 255.0f * along);
+
+      if (scene->noise > 0) {
+        v += (int)(rng_next(rng) % (2 * scene->noise + 1)) - scene->noise;
+      }
+      frame[y * w + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+  }
+
+  return 0;
+}
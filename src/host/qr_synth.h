@@ -0,0 +1,59 @@
+/* Synthetic QR codes for benchmarks: a byte-mode encoder and a renderer
+ * that places a code in a camera-sized frame with perspective, blur,
+ * noise, uneven lighting and background clutter.
+ */
+
+#ifndef QR_SYNTH_H_
+#define QR_SYNTH_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Modules across the largest code */
+#define QR_SYNTH_MAX_SIZE 177
+
+/* Encodes a payload in byte mode into grid, one byte per module, 1 for
+ * black, rows of size modules. Returns the size, or -1 if the payload
+ * doesn't fit the version and ECC level.
+ */
+int qr_synth_encode(const uint8_t* payload, int len, int version, int ecc_level, int mask, uint8_t* grid);
+
+/* How a code is rendered. Distances are in pixels, levels in 0-255. */
+struct qr_synth_scene {
+  /* Side of the code, quiet zone excluded, as a fraction of the smaller
+   * side of the frame, and the least pixels per module allowed
+   */
+  float fill;
+  float min_module;
+
+  /* Each corner is moved by up to this fraction of the code's side */
+  float perspective;
+
+  /* Radius of the box blur, 0 for none */
+  int blur;
+
+  /* Amplitude of uniform noise added to every pixel */
+  int noise;
+
+  /* Difference in brightness between the lightest and darkest corner */
+  int lighting;
+
+  /* Random bars and blocks drawn around the code */
+  int clutter;
+};
+
+/* Renders a code into a w x h frame. The rng state is advanced, so
+ * successive calls give different placements. Returns -1 if the code
+ * doesn't fit the frame at the smallest module size.
+ */
+int qr_synth_render(const uint8_t* grid, int size, const struct qr_synth_scene* scene, uint32_t* rng, uint8_t* frame,
+                    int w, int h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
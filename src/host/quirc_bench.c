@@ -0,0 +1,432 @@
+/* Times each stage of the recognizer on synthetic codes and reports the
+ * results in a machine-readable form, to compare changes against a
+ * baseline run.
+ *
+ *   quirc_bench [-r WxH]... [-V first-last] [-n codes] [-F fill]
+ *               [-p perspective] [-b blur] [-N noise] [-l lighting]
+ *               [-c clutter] [-S seed] [-P scale] [-w] [-j] [-o dir]
+ *
+ * For every resolution and version, codes cycle through the ECC levels
+ * and masks, 32 of them covering every combination. Each is rendered
+ * into its own frame and processed with the firmware's settings. One
+ * line per version and a total per resolution give the frames that
+ * fitted, the frames in which a grid was found and the correct payload
+ * decoded, the mean microseconds of each stage and the frames per
+ * second they add up to.
+ *
+ *   -r WxH  camera resolution, may be repeated; QVGA, VGA and SVGA if not
+ *   -V      range of versions, 1-40 by default
+ *   -n      codes per version, 32 by default
+ *   -F      side of the code as a fraction of the shorter side of the frame, 0.6
+ *   -p      corners move by up to this fraction of the code, 0.08
+ *   -b      box blur radius, 1
+ *   -N      noise amplitude, 8
+ *   -l      darkening across the frame, 0-255, 80
+ *   -c      clutter items around the code, 40
+ *   -S      random seed, 1
+ *   -P      look for codes at 1/2 or 1/4 of the resolution first
+ *   -w      count the grid samples the stepped perspective walk puts on
+ *           a different pixel from a divide per sample; needs a build
+ *           with -DQUIRC_PERSPECTIVE_CHECK=1, which slows the grid stages
+ *   -j      JSON lines instead of CSV
+ *   -o dir  also write every frame there as a PGM, for quirc_replay
+ */
+
+#include "../quirc/quirc_internal.h"
+#include "qr_synth.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_SIZES          8
+#define BENCH_PIXELS_PER_REGION  256
+#define BENCH_FLOOD_FILL_REGIONS 254
+#define BENCH_RUN_TABLE_BYTES    (1024 * 1024)
+#define BENCH_PAYLOAD_MAX        24
+
+/* Stages of a frame, those of quirc_end() followed by the decoder's */
+#define BENCH_EXTRACT (QUIRC_STAGE_COUNT)
+#define BENCH_DECODE  (QUIRC_STAGE_COUNT + 1)
+#define BENCH_STAGES  (QUIRC_STAGE_COUNT + 2)
+
+static const char* const stage_names[BENCH_STAGES] = {"threshold", "label", "finders", "grids", "extract", "decode"};
+
+struct bench_result {
+  int frames;
+  int skipped;
+  int found;
+  int decoded;
+  double stage_us[BENCH_STAGES];
+  long walk_samples;
+  long walk_mismatched;
+};
+
+struct bench {
+  struct quirc* q;
+  struct quirc_code code;
+  struct quirc_data data;
+  struct quirc_decode_scratch scratch;
+  uint8_t grid[QR_SYNTH_MAX_SIZE * QR_SYNTH_MAX_SIZE];
+
+  struct qr_synth_scene scene;
+  uint32_t rng;
+  int json;
+  int pyramid;
+  int walk_check;
+  const char* out_dir;
+};
+
+static uint32_t now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static int setup(struct bench* b, int w, int h) {
+  if (!b->q) {
+    b->q = quirc_new();
+    if (!b->q) {
+      return -1;
+    }
+
+    /* As in the firmware, except that frames are unrelated so nothing
+     * is tracked
+     */
+    quirc_set_packed_scan(b->q, 1);
+    quirc_set_max_run_bytes(b->q, BENCH_RUN_TABLE_BYTES);
+    quirc_set_threshold(b->q, QUIRC_THRESHOLD_BOX);
+    quirc_set_stage_clock(b->q, now_us);
+    if (quirc_set_pyramid(b->q, b->pyramid) < 0) {
+      return -1;
+    }
+  }
+
+  if (quirc_resize(b->q, w, h) < 0) {
+    return -1;
+  }
+
+  /* Runs only where flood filling would run out of regions */
+  if (w * h / BENCH_PIXELS_PER_REGION <= BENCH_FLOOD_FILL_REGIONS) {
+    quirc_set_max_regions(b->q, BENCH_FLOOD_FILL_REGIONS);
+    return quirc_set_run_labels(b->q, 0);
+  }
+  if (quirc_set_run_labels(b->q, 1) < 0) {
+    return -1;
+  }
+  quirc_set_max_regions(b->q, w * h / BENCH_PIXELS_PER_REGION);
+  return 0;
+}
+
+/* Encodes as much of a per-code text as the version and level hold */
+static int encode(struct bench* b, int version, int ecc_level, int mask, int n, uint8_t* payload) {
+  int len = snprintf((char*)payload, BENCH_PAYLOAD_MAX, "cube-%d-%d-%d-%d", version, ecc_level, mask, n);
+  int size = -1;
+
+  while (len > 0 && (size = qr_synth_encode(payload, len, version, ecc_level, mask, b->grid)) < 0) {
+    payload[--len] = 0;
+  }
+
+  return size;
+}
+
+static void write_pgm(const struct bench* b, const uint8_t* frame, int w, int h, int version, int n) {
+  char path[1024];
+  FILE* f;
+
+  snprintf(path, sizeof(path), "%s/%dx%d_v%02d_%02d.pgm", b->out_dir, w, h, version, n);
+  f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return;
+  }
+  fprintf(f, "P5\n%d %d\n255\n", w, h);
+  fwrite(frame, 1, (size_t)w * h, f);
+  fclose(f);
+}
+
+static void run_frame(struct bench* b, const uint8_t* frame, const uint8_t* payload, struct bench_result* res) {
+  int len = strlen((const char*)payload);
+  int count, decoded = 0;
+  int i;
+
+  quirc_begin_borrowed(b->q, frame);
+  quirc_end(b->q);
+  for (i = 0; i < QUIRC_STAGE_COUNT; i++) {
+    res->stage_us[i] += quirc_stage_ticks(b->q, (quirc_stage_t)i);
+  }
+
+  count = quirc_count(b->q);
+  for (i = 0; i < count; i++) {
+    uint32_t start = now_us();
+    uint32_t extracted;
+    quirc_decode_error_t err;
+
+    quirc_extract(b->q, i, &b->code);
+    extracted = now_us();
+    err = quirc_decode_with_scratch(&b->code, &b->data, &b->scratch);
+    res->stage_us[BENCH_EXTRACT] += extracted - start;
+    res->stage_us[BENCH_DECODE] += now_us() - extracted;
+
+    if (!err && b->data.payload_len == len && !memcmp(b->data.payload, payload, len)) {
+      decoded = 1;
+    }
+  }
+
+#if QUIRC_PERSPECTIVE_CHECK
+  if (b->walk_check) {
+    long samples;
+
+    res->walk_mismatched += quirc_perspective_check(&samples);
+    res->walk_samples += samples;
+  }
+#endif
+
+  res->frames++;
+  res->found += count > 0;
+  res->decoded += decoded;
+}
+
+static void add_result(struct bench_result* total, const struct bench_result* res) {
+  int i;
+
+  total->frames += res->frames;
+  total->skipped += res->skipped;
+  total->found += res->found;
+  total->decoded += res->decoded;
+  for (i = 0; i < BENCH_STAGES; i++) {
+    total->stage_us[i] += res->stage_us[i];
+  }
+  total->walk_samples += res->walk_samples;
+  total->walk_mismatched += res->walk_mismatched;
+}
+
+static void print_header(const struct bench* b) {
+  int i;
+
+  if (b->json) {
+    return;
+  }
+  printf("resolution,version,frames,skipped,found,decoded");
+  for (i = 0; i < BENCH_STAGES; i++) {
+    printf(",%s_us", stage_names[i]);
+  }
+  printf(",total_us,fps%s\n", b->walk_check ? ",walk_samples,walk_mismatched" : "");
+}
+
+static void print_result(const struct bench* b, int w, int h, int version, const struct bench_result* res) {
+  double total = 0;
+  int i;
+
+  if (b->json) {
+    printf("{\"resolution\":\"%dx%d\",\"version\":", w, h);
+    printf(version ? "%d" : "\"all\"", version);
+    printf(",\"frames\":%d,\"skipped\":%d,\"found\":%d,\"decoded\":%d", res->frames, res->skipped, res->found,
+           res->decoded);
+  } else {
+    printf("%dx%d,", w, h);
+    printf(version ? "%d" : "all", version);
+    printf(",%d,%d,%d,%d", res->frames, res->skipped, res->found, res->decoded);
+  }
+
+  for (i = 0; i < BENCH_STAGES; i++) {
+    double us = res->frames ? res->stage_us[i] / res->frames : 0;
+
+    if (b->json) {
+      printf(",\"%s_us\":%.1f", stage_names[i], us);
+    } else {
+      printf(",%.1f", us);
+    }
+    total += us;
+  }
+
+  if (b->json) {
+    printf(",\"total_us\":%.1f,\"fps\":%.1f", total, total > 0 ? 1e6 / total : 0);
+    if (b->walk_check) {
+      printf(",\"walk_samples\":%ld,\"walk_mismatched\":%ld", res->walk_samples, res->walk_mismatched);
+    }
+    printf("}\n");
+  } else {
+    printf(",%.1f,%.1f", total, total > 0 ? 1e6 / total : 0);
+    if (b->walk_check) {
+      printf(",%ld,%ld", res->walk_samples, res->walk_mismatched);
+    }
+    printf("\n");
+  }
+}
+
+static int run_resolution(struct bench* b, int w, int h, int first, int last, int codes) {
+  struct bench_result total = {0};
+  uint8_t* frame = malloc((size_t)w * h);
+  int version, n;
+
+  if (!frame || setup(b, w, h) < 0) {
+    fprintf(stderr, "can't set up %dx%d\n", w, h);
+    free(frame);
+    return -1;
+  }
+
+  for (version = first; version <= last; version++) {
+    struct bench_result res = {0};
+
+    for (n = 0; n < codes; n++) {
+      uint8_t payload[BENCH_PAYLOAD_MAX];
+      int size = encode(b, version, n % 4, (n / 4) % 8, n, payload);
+
+      if (size < 0 || qr_synth_render(b->grid, size, &b->scene, &b->rng, frame, w, h) < 0) {
+        res.skipped++;
+        continue;
+      }
+      if (b->out_dir) {
+        write_pgm(b, frame, w, h, version, n);
+      }
+      run_frame(b, frame, payload, &res);
+    }
+
+    print_result(b, w, h, version, &res);
+    add_result(&total, &res);
+  }
+
+  print_result(b, w, h, 0, &total);
+  free(frame);
+  return 0;
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [-r WxH]... [-V first-last] [-n codes] [-F fill] [-p perspective] [-b blur]\n"
+          "       [-N noise] [-l lighting] [-c clutter] [-S seed] [-P scale] [-w] [-j] [-o dir]\n",
+          prog);
+}
+
+int main(int argc, char** argv) {
+  static const int default_sizes[][2] = {{320, 240}, {640, 480}, {800, 600}};
+  struct bench* b = calloc(1, sizeof(*b));
+  int sizes[BENCH_MAX_SIZES][2];
+  int num_sizes = 0;
+  int first = 1, last = 40;
+  int codes = 32;
+  int ret = 0;
+  int opt, i;
+
+  if (!b) {
+    return 1;
+  }
+  b->scene.fill = 0.6f;
+  b->scene.min_module = 2.0f;
+  b->scene.perspective = 0.08f;
+  b->scene.blur = 1;
+  b->scene.noise = 8;
+  b->scene.lighting = 80;
+  b->scene.clutter = 40;
+  b->rng = 1;
+  b->pyramid = 1;
+
+  while ((opt = getopt(argc, argv, "r:V:n:F:p:b:N:l:c:S:P:wjo:")) >= 0) {
+    switch (opt) {
+    case 'r':
+      if (num_sizes == BENCH_MAX_SIZES || sscanf(optarg, "%dx%d", &sizes[num_sizes][0], &sizes[num_sizes][1]) != 2
+          || sizes[num_sizes][0] <= 0 || sizes[num_sizes][1] <= 0) {
+        fprintf(stderr, "bad resolution: %s\n", optarg);
+        return 1;
+      }
+      num_sizes++;
+      break;
+
+    case 'V':
+      if (sscanf(optarg, "%d-%d", &first, &last) != 2) {
+        first = last = atoi(optarg);
+      }
+      if (first < 1 || last > 40 || first > last) {
+        fprintf(stderr, "bad version range: %s\n", optarg);
+        return 1;
+      }
+      break;
+
+    case 'n':
+      codes = atoi(optarg);
+      break;
+
+    case 'F':
+      b->scene.fill = atof(optarg);
+      break;
+
+    case 'p':
+      b->scene.perspective = atof(optarg);
+      break;
+
+    case 'b':
+      b->scene.blur = atoi(optarg);
+      break;
+
+    case 'N':
+      b->scene.noise = atoi(optarg);
+      break;
+
+    case 'l':
+      b->scene.lighting = atoi(optarg);
+      break;
+
+    case 'c':
+      b->scene.clutter = atoi(optarg);
+      break;
+
+    case 'S':
+      b->rng = strtoul(optarg, NULL, 0);
+      break;
+
+    case 'P':
+      b->pyramid = atoi(optarg);
+      break;
+
+    case 'w':
+      b->walk_check = 1;
+      break;
+
+    case 'j':
+      b->json = 1;
+      break;
+
+    case 'o':
+      b->out_dir = optarg;
+      break;
+
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind < argc || codes < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (b->walk_check && !QUIRC_PERSPECTIVE_CHECK) {
+    fprintf(stderr, "-w needs a build with -DQUIRC_PERSPECTIVE_CHECK=1\n");
+    return 1;
+  }
+  if (!b->rng) {
+    b->rng = 1;
+  }
+  if (!num_sizes) {
+    for (i = 0; i < 3; i++) {
+      sizes[i][0] = default_sizes[i][0];
+      sizes[i][1] = default_sizes[i][1];
+    }
+    num_sizes = 3;
+  }
+
+  print_header(b);
+  for (i = 0; i < num_sizes; i++) {
+    if (run_resolution(b, sizes[i][0], sizes[i][1], first, last, codes) < 0) {
+      ret = 1;
+    }
+  }
+
+  quirc_destroy(b->q);
+  free(b);
+  return ret;
+}
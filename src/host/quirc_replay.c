@@ -0,0 +1,424 @@
+/* Replays grayscale captures through the recognizer, set up the way the
+ * firmware runs it, and reports per-stage timings and what was decoded.
+ *
+ *   quirc_replay [-s WxH] [-t avg|box|otsu] [-f] [-n] [-P scale] [-v] path...
+ *
+ * A path is a binary 8-bit PGM file, a raw luma file of one or more
+ * frames of the size given with -s, or a directory of those, read in
+ * name order. Frames are processed in the order given so tracking
+ * behaves as it would on a live stream.
+ *
+ *   -s WxH  size of raw frames
+ *   -t      thresholding method, box by default as in the firmware
+ *   -f      flood fill regions instead of labelling runs
+ *   -n      don't track codes from one frame to the next
+ *   -P      look for codes at 1/2 or 1/4 of the resolution first
+ *   -v      print every decoded payload
+ */
+
+#include "../quirc/quirc.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_PIXELS_PER_REGION 256
+
+/* Stages of a frame, those of quirc_end() followed by the decoder's */
+#define REPLAY_EXTRACT (QUIRC_STAGE_COUNT)
+#define REPLAY_DECODE  (QUIRC_STAGE_COUNT + 1)
+#define REPLAY_STAGES  (QUIRC_STAGE_COUNT + 2)
+
+static const char* const stage_names[REPLAY_STAGES] = {"threshold", "label", "finders", "grids", "extract", "decode"};
+
+struct replay {
+  struct quirc* q;
+  struct quirc_code code;
+  struct quirc_data data;
+  struct quirc_decode_scratch scratch;
+
+  /* Settings */
+  int raw_w;
+  int raw_h;
+  quirc_threshold_t threshold;
+  int run_labels;
+  int tracking;
+  int pyramid;
+  int verbose;
+
+  /* Totals */
+  int frames;
+  int frames_decoded;
+  int codes;
+  int decoded;
+  int errors[QUIRC_ERROR_OUT_OF_MEMORY + 1];
+  double stage_us[REPLAY_STAGES];
+};
+
+static uint32_t now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static int has_suffix(const char* name, const char* suffix) {
+  size_t n = strlen(name);
+  size_t s = strlen(suffix);
+
+  return n >= s && !strcasecmp(name + n - s, suffix);
+}
+
+static uint8_t* read_file(const char* path, long* len) {
+  FILE* f = fopen(path, "rb");
+  uint8_t* buf = NULL;
+
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+
+  if (fseek(f, 0, SEEK_END) == 0 && (*len = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+    buf = malloc(*len);
+    if (buf && fread(buf, 1, *len, f) != (size_t)*len) {
+      free(buf);
+      buf = NULL;
+    }
+  }
+  if (!buf) {
+    fprintf(stderr, "%s: can't read file\n", path);
+  }
+
+  fclose(f);
+  return buf;
+}
+
+/* Reads one header field of a PGM file, skipping whitespace and comments */
+static int pgm_field(const uint8_t* buf, long len, long* pos) {
+  int value = 0;
+  int digits = 0;
+
+  while (*pos < len) {
+    if (buf[*pos] == '#') {
+      while (*pos < len && buf[*pos] != '\n') {
+        (*pos)++;
+      }
+    } else if (buf[*pos] == ' ' || buf[*pos] == '\t' || buf[*pos] == '\r' || buf[*pos] == '\n') {
+      (*pos)++;
+    } else {
+      break;
+    }
+  }
+
+  while (*pos < len && buf[*pos] >= '0' && buf[*pos] <= '9' && digits < 9) {
+    value = value * 10 + buf[(*pos)++] - '0';
+    digits++;
+  }
+
+  return digits ? value : -1;
+}
+
+/* Returns the offset of the pixels of a binary 8-bit PGM, or -1 */
+static long pgm_header(const uint8_t* buf, long len, int* w, int* h) {
+  long pos = 2;
+  int maxval;
+
+  if (len < 2 || buf[0] != 'P' || buf[1] != '5') {
+    return -1;
+  }
+
+  *w = pgm_field(buf, len, &pos);
+  *h = pgm_field(buf, len, &pos);
+  maxval = pgm_field(buf, len, &pos);
+  if (*w <= 0 || *h <= 0 || maxval <= 0 || maxval > 255 || pos >= len) {
+    return -1;
+  }
+
+  /* A single whitespace character ends the header */
+  pos++;
+  if (len - pos < (long)*w * *h) {
+    return -1;
+  }
+
+  return pos;
+}
+
+/* Same order of setup as qrcode_session_prepare() in the firmware */
+static int prepare(struct replay* r, int w, int h) {
+  if (!r->q) {
+    r->q = quirc_new();
+    if (!r->q) {
+      fprintf(stderr, "can't create quirc object\n");
+      return -1;
+    }
+
+    quirc_set_packed_scan(r->q, 1);
+    if (quirc_set_run_labels(r->q, r->run_labels) < 0) {
+      fprintf(stderr, "can't set run labelling, regions are flood filled\n");
+    }
+    if (quirc_set_threshold(r->q, r->threshold) < 0) {
+      fprintf(stderr, "can't select threshold method, using default\n");
+    }
+    quirc_set_tracking(r->q, r->tracking);
+    if (quirc_set_pyramid(r->q, r->pyramid) < 0) {
+      fprintf(stderr, "can't set up a coarse pass at 1/%d, using full resolution\n", r->pyramid);
+    }
+    quirc_set_stage_clock(r->q, now_us);
+  }
+
+  if (quirc_resize(r->q, w, h) < 0) {
+    fprintf(stderr, "can't resize quirc object to %dx%d\n", w, h);
+    return -1;
+  }
+  /* Flood filling stays at the default */
+  if (r->run_labels) {
+    quirc_set_max_regions(r->q, w * h / REPLAY_PIXELS_PER_REGION);
+  }
+
+  return 0;
+}
+
+static int replay_frame(struct replay* r, const char* name, const uint8_t* pixels, int w, int h) {
+  uint32_t us[REPLAY_STAGES] = {0};
+  int count, decoded = 0;
+  int i;
+
+  if (prepare(r, w, h) < 0) {
+    return -1;
+  }
+
+  quirc_begin_borrowed(r->q, pixels);
+  quirc_end(r->q);
+  for (i = 0; i < QUIRC_STAGE_COUNT; i++) {
+    us[i] = quirc_stage_ticks(r->q, (quirc_stage_t)i);
+  }
+
+  count = quirc_count(r->q);
+  for (i = 0; i < count; i++) {
+    uint32_t start = now_us();
+    uint32_t extracted;
+    quirc_decode_error_t err;
+
+    quirc_extract(r->q, i, &r->code);
+    extracted = now_us();
+    err = quirc_decode_with_scratch(&r->code, &r->data, &r->scratch);
+    us[REPLAY_EXTRACT] += extracted - start;
+    us[REPLAY_DECODE] += now_us() - extracted;
+
+    r->errors[err]++;
+    if (err) {
+      continue;
+    }
+
+    decoded++;
+    if (r->verbose) {
+      printf("  v%d: %s\n", r->data.version, r->data.payload);
+    }
+  }
+
+  printf("%-32s %4dx%-4d %5d %7d", name, w, h, count, decoded);
+  for (i = 0; i < REPLAY_STAGES; i++) {
+    printf(" %9u", us[i]);
+    r->stage_us[i] += us[i];
+  }
+  printf("\n");
+
+  r->frames++;
+  r->frames_decoded += decoded > 0;
+  r->codes += count;
+  r->decoded += decoded;
+  return 0;
+}
+
+static int replay_file(struct replay* r, const char* path) {
+  const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  long len;
+  uint8_t* buf = read_file(path, &len);
+  int ret = 0;
+
+  if (!buf) {
+    return -1;
+  }
+
+  if (has_suffix(path, ".pgm")) {
+    int w, h;
+    long offset = pgm_header(buf, len, &w, &h);
+
+    if (offset < 0) {
+      fprintf(stderr, "%s: not a binary 8-bit PGM file\n", path);
+      ret = -1;
+    } else {
+      ret = replay_frame(r, name, buf + offset, w, h);
+    }
+  } else if (!r->raw_w) {
+    fprintf(stderr, "%s: raw frames need a size, given with -s\n", path);
+    ret = -1;
+  } else {
+    long frame = (long)r->raw_w * r->raw_h;
+    long n;
+
+    if (len < frame) {
+      fprintf(stderr, "%s: shorter than one %dx%d frame\n", path, r->raw_w, r->raw_h);
+      ret = -1;
+    }
+    for (n = 0; ret == 0 && (n + 1) * frame <= len; n++) {
+      ret = replay_frame(r, name, buf + n * frame, r->raw_w, r->raw_h);
+    }
+  }
+
+  free(buf);
+  return ret;
+}
+
+static int skip_entry(const struct dirent* entry) { return entry->d_name[0] != '.'; }
+
+static int replay_path(struct replay* r, const char* path) {
+  struct stat st;
+  struct dirent** entries;
+  int n, i;
+  int ret = 0;
+
+  if (stat(path, &st) < 0) {
+    perror(path);
+    return -1;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return replay_file(r, path);
+  }
+
+  n = scandir(path, &entries, skip_entry, alphasort);
+  if (n < 0) {
+    perror(path);
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    char* child = malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+
+    if (child) {
+      sprintf(child, "%s/%s", path, entries[i]->d_name);
+      if (stat(child, &st) == 0 && S_ISREG(st.st_mode) && replay_file(r, child) < 0) {
+        ret = -1;
+      }
+      free(child);
+    }
+    free(entries[i]);
+  }
+
+  free(entries);
+  return ret;
+}
+
+static void print_summary(const struct replay* r) {
+  double total = 0;
+  int i;
+
+  printf("\n%d frames, %d with a decoded code; %d codes found, %d decoded\n", r->frames, r->frames_decoded, r->codes,
+         r->decoded);
+  for (i = 1; i <= QUIRC_ERROR_OUT_OF_MEMORY; i++) {
+    if (r->errors[i]) {
+      printf("  %5d x %s\n", r->errors[i], quirc_strerror((quirc_decode_error_t)i));
+    }
+  }
+
+  if (!r->frames) {
+    return;
+  }
+
+  printf("\nmean us per frame:\n");
+  for (i = 0; i < REPLAY_STAGES; i++) {
+    printf("  %-10s %10.1f\n", stage_names[i], r->stage_us[i] / r->frames);
+    total += r->stage_us[i];
+  }
+  printf("  %-10s %10.1f\n", "total", total / r->frames);
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-s WxH] [-t avg|box|otsu] [-f] [-n] [-P scale] [-v] path...\n", prog);
+}
+
+int main(int argc, char** argv) {
+  struct replay* r = calloc(1, sizeof(*r));
+  int ret = 0;
+  int opt, i;
+
+  if (!r) {
+    return 1;
+  }
+  r->threshold = QUIRC_THRESHOLD_BOX;
+  r->run_labels = 1;
+  r->tracking = 1;
+  r->pyramid = 1;
+
+  while ((opt = getopt(argc, argv, "s:t:fnP:v")) >= 0) {
+    switch (opt) {
+    case 's':
+      if (sscanf(optarg, "%dx%d", &r->raw_w, &r->raw_h) != 2 || r->raw_w <= 0 || r->raw_h <= 0) {
+        fprintf(stderr, "bad frame size: %s\n", optarg);
+        return 1;
+      }
+      break;
+
+    case 't':
+      if (!strcmp(optarg, "avg")) {
+        r->threshold = QUIRC_THRESHOLD_MOVING_AVERAGE;
+      } else if (!strcmp(optarg, "box")) {
+        r->threshold = QUIRC_THRESHOLD_BOX;
+      } else if (!strcmp(optarg, "otsu")) {
+        r->threshold = QUIRC_THRESHOLD_OTSU;
+      } else {
+        fprintf(stderr, "unknown threshold method: %s\n", optarg);
+        return 1;
+      }
+      break;
+
+    case 'f':
+      r->run_labels = 0;
+      break;
+
+    case 'n':
+      r->tracking = 0;
+      break;
+
+    case 'P':
+      r->pyramid = atoi(optarg);
+      break;
+
+    case 'v':
+      r->verbose = 1;
+      break;
+
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  printf("%-32s %9s %5s %7s", "frame", "size", "codes", "decoded");
+  for (i = 0; i < REPLAY_STAGES; i++) {
+    printf(" %9s", stage_names[i]);
+  }
+  printf("\n");
+
+  for (i = optind; i < argc; i++) {
+    if (replay_path(r, argv[i]) < 0) {
+      ret = 1;
+    }
+  }
+
+  print_summary(r);
+
+  quirc_destroy(r->q);
+  free(r);
+  return ret;
+}
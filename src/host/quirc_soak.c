@@ -0,0 +1,253 @@
+/* Runs the recognizer the way the firmware does over thousands of frames
+ * and fails if the heap grew. Once the frame pools have grown to fit the
+ * busiest frame, processing a frame must not allocate anything that is
+ * not freed again.
+ *
+ *   quirc_soak [-n frames] [-k codes] [-S seed]
+ *
+ * A fixed set of synthetic codes, versions 1 to 10 at every ECC level
+ * and mask, is rendered at 640x480 and at 800x600. Rounds go through all
+ * of them at one size, then at the other, so the recognizer is resized
+ * twice per round as it would be when the camera's frame size changes.
+ * After two rounds to warm up, the bytes in use on the heap are noted
+ * and the rounds go on until at least the given number of frames were
+ * processed. The heap is compared at the end of the last round. The
+ * exit status is 1 if it grew or if no code was decoded at all.
+ *
+ *   -n      frames to process after warming up, 5000 by default
+ *   -k      codes per size, 40 by default
+ *   -S      random seed, 1
+ */
+
+#include "../quirc/quirc.h"
+#include "qr_synth.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if !defined(__GLIBC__)
+#error "quirc_soak reads heap usage with glibc's mallinfo"
+#endif
+
+#define SOAK_SIZES              2
+#define SOAK_WARMUP_ROUNDS      2
+#define SOAK_PIXELS_PER_REGION  256
+#define SOAK_FLOOD_FILL_REGIONS 254
+#define SOAK_RUN_TABLE_BYTES    (1024 * 1024)
+#define SOAK_PAYLOAD_MAX        24
+
+struct soak {
+  struct quirc* q;
+  struct quirc_code code;
+  struct quirc_data data;
+  struct quirc_decode_scratch scratch;
+
+  int codes;
+  uint8_t* frames[SOAK_SIZES];
+  uint8_t (*payloads)[SOAK_PAYLOAD_MAX];
+
+  long processed;
+  long decoded;
+};
+
+static const int sizes[SOAK_SIZES][2] = {{640, 480}, {800, 600}};
+
+static size_t heap_in_use(void) {
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+  return mallinfo2().uordblks;
+#else
+  return (unsigned)mallinfo().uordblks;
+#endif
+}
+
+/* Renders every code at every size up front, so that the heap only
+ * changes with what the recognizer does
+ */
+static int render_frames(struct soak* s, uint32_t rng) {
+  static uint8_t grid[QR_SYNTH_MAX_SIZE * QR_SYNTH_MAX_SIZE];
+  struct qr_synth_scene scene = {0.5f, 2.0f, 0.08f, 1, 8, 80, 40};
+  int i, n;
+
+  s->payloads = calloc(s->codes, SOAK_PAYLOAD_MAX);
+  if (!s->payloads) {
+    return -1;
+  }
+
+  for (i = 0; i < SOAK_SIZES; i++) {
+    int w = sizes[i][0];
+    int h = sizes[i][1];
+
+    s->frames[i] = malloc((size_t)w * h * s->codes);
+    if (!s->frames[i]) {
+      return -1;
+    }
+
+    for (n = 0; n < s->codes; n++) {
+      uint8_t* payload = s->payloads[n];
+      uint8_t* frame = s->frames[i] + (size_t)w * h * n;
+      int version = 1 + n % 10;
+      int len = snprintf((char*)payload, SOAK_PAYLOAD_MAX, "soak-%d-%d", version, n);
+      int size = -1;
+
+      while (len > 0 && (size = qr_synth_encode(payload, len, version, n % 4, (n / 4) % 8, grid)) < 0) {
+        payload[--len] = 0;
+      }
+
+      /* A frame without a code is still worth processing */
+      if (size < 0 || qr_synth_render(grid, size, &scene, &rng, frame, w, h) < 0) {
+        memset(frame, 0x80, (size_t)w * h);
+        payload[0] = 0;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* Same order of setup as qrcode_session_prepare() in the firmware */
+static int prepare(struct soak* s, int w, int h) {
+  if (!s->q) {
+    s->q = quirc_new();
+    if (!s->q) {
+      return -1;
+    }
+
+    quirc_set_packed_scan(s->q, 1);
+    quirc_set_max_run_bytes(s->q, SOAK_RUN_TABLE_BYTES);
+    quirc_set_threshold(s->q, QUIRC_THRESHOLD_BOX);
+    quirc_set_tracking(s->q, 1);
+    if (quirc_set_pyramid(s->q, 2) < 0) {
+      return -1;
+    }
+  }
+
+  if (quirc_resize(s->q, w, h) < 0) {
+    return -1;
+  }
+
+  /* Runs only where flood filling would run out of regions */
+  if (w * h / SOAK_PIXELS_PER_REGION <= SOAK_FLOOD_FILL_REGIONS) {
+    quirc_set_max_regions(s->q, SOAK_FLOOD_FILL_REGIONS);
+    return quirc_set_run_labels(s->q, 0);
+  }
+  if (quirc_set_run_labels(s->q, 1) < 0) {
+    return -1;
+  }
+  return quirc_set_max_regions(s->q, w * h / SOAK_PIXELS_PER_REGION);
+}
+
+static int run_round(struct soak* s) {
+  int i, n, k;
+
+  for (i = 0; i < SOAK_SIZES; i++) {
+    int w = sizes[i][0];
+    int h = sizes[i][1];
+
+    for (n = 0; n < s->codes; n++) {
+      const uint8_t* payload = s->payloads[n];
+      int len = strlen((const char*)payload);
+
+      if (prepare(s, w, h) < 0) {
+        fprintf(stderr, "can't set up the recognizer for %dx%d\n", w, h);
+        return -1;
+      }
+
+      quirc_begin_borrowed(s->q, s->frames[i] + (size_t)w * h * n);
+      quirc_end(s->q);
+
+      for (k = 0; k < quirc_count(s->q); k++) {
+        quirc_extract(s->q, k, &s->code);
+        if (!quirc_decode_with_scratch(&s->code, &s->data, &s->scratch) && len && s->data.payload_len == len
+            && !memcmp(s->data.payload, payload, len)) {
+          s->decoded++;
+        }
+      }
+      s->processed++;
+    }
+  }
+
+  return 0;
+}
+
+static void usage(const char* prog) { fprintf(stderr, "usage: %s [-n frames] [-k codes] [-S seed]\n", prog); }
+
+int main(int argc, char** argv) {
+  struct soak* s = calloc(1, sizeof(*s));
+  long frames = 5000;
+  uint32_t rng = 1;
+  size_t before, after;
+  int ret = 0;
+  int opt, i;
+
+  if (!s) {
+    return 1;
+  }
+  s->codes = 40;
+
+  while ((opt = getopt(argc, argv, "n:k:S:")) >= 0) {
+    switch (opt) {
+    case 'n':
+      frames = atol(optarg);
+      break;
+
+    case 'k':
+      s->codes = atoi(optarg);
+      break;
+
+    case 'S':
+      rng = strtoul(optarg, NULL, 0);
+      break;
+
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind < argc || frames < 1 || s->codes < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (render_frames(s, rng ? rng : 1) < 0) {
+    fprintf(stderr, "can't render %d codes\n", s->codes);
+    return 1;
+  }
+
+  for (i = 0; i < SOAK_WARMUP_ROUNDS; i++) {
+    if (run_round(s) < 0) {
+      return 1;
+    }
+  }
+
+  before = heap_in_use();
+  s->processed = 0;
+  s->decoded = 0;
+  while (s->processed < frames) {
+    if (run_round(s) < 0) {
+      return 1;
+    }
+  }
+  after = heap_in_use();
+
+  printf("%ld frames, %ld codes decoded; heap in use %zu bytes before, %zu after\n", s->processed, s->decoded, before,
+         after);
+  if (after > before) {
+    printf("FAIL: the heap grew by %zu bytes\n", after - before);
+    ret = 1;
+  } else if (!s->decoded) {
+    printf("FAIL: nothing was decoded\n");
+    ret = 1;
+  }
+
+  quirc_destroy(s->q);
+  for (i = 0; i < SOAK_SIZES; i++) {
+    free(s->frames[i]);
+  }
+  free(s->payloads);
+  free(s);
+  return ret;
+}
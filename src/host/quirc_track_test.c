@@ -0,0 +1,159 @@
+/* Checks that tracking never loses a code, whichever way the image is
+ * handed over.
+ *
+ *   quirc_track_test
+ *
+ * In the first scene a version 2 code is drawn at one place, then at
+ * another place well away from it, and left there. In the second a code
+ * stays put while a second one arrives on the far side of the frame.
+ * Every code in every frame has to decode, with the image given through
+ * quirc_begin(), quirc_begin() with a separate label plane and
+ * quirc_begin_borrowed(), each with and without the coarse pass. The
+ * exit status is 1 if any code was missed.
+ */
+
+#include "../quirc/quirc.h"
+#include "qr_synth.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACK_W         320
+#define TRACK_H         240
+#define TRACK_MODULE    4
+#define TRACK_VERSION   2
+#define TRACK_MAX_CODES 2
+
+enum input_mode { INPUT_COPY, INPUT_SEPARATE, INPUT_BORROWED, INPUT_MODES };
+
+static const char* const input_names[INPUT_MODES] = {"quirc_begin", "separate labels", "borrowed"};
+
+static const char* const payloads[TRACK_MAX_CODES] = {"track", "arrives"};
+
+/* Top-left corner of each code, quiet zone excluded, or -1 where it is
+ * not in the frame
+ */
+struct track_frame {
+  int pos[TRACK_MAX_CODES][2];
+};
+
+struct track_scene {
+  const char* name;
+  int frames;
+  struct track_frame frame[4];
+};
+
+static const struct track_scene scenes[] = {
+    {"code moves", 3, {{{{20, 120}, {-1, -1}}}, {{{196, 16}, {-1, -1}}}, {{{196, 16}, {-1, -1}}}}},
+    {"second code arrives",
+     4,
+     {{{{20, 20}, {-1, -1}}}, {{{20, 20}, {196, 120}}}, {{{20, 20}, {196, 120}}}, {{{20, 20}, {196, 120}}}}},
+};
+
+#define TRACK_SCENES ((int)(sizeof(scenes) / sizeof(scenes[0])))
+
+struct track_codes {
+  uint8_t grid[TRACK_MAX_CODES][QR_SYNTH_MAX_SIZE * QR_SYNTH_MAX_SIZE];
+  int size;
+};
+
+static void draw_frame(uint8_t* frame, const struct track_codes* codes, const struct track_frame* f) {
+  int i, x, y;
+
+  memset(frame, 200, TRACK_W * TRACK_H);
+  for (i = 0; i < TRACK_MAX_CODES; i++) {
+    int left = f->pos[i][0];
+    int top = f->pos[i][1];
+
+    if (left < 0) {
+      continue;
+    }
+    for (y = 0; y < codes->size * TRACK_MODULE; y++) {
+      for (x = 0; x < codes->size * TRACK_MODULE; x++) {
+        if (codes->grid[i][(y / TRACK_MODULE) * codes->size + x / TRACK_MODULE]) {
+          frame[(top + y) * TRACK_W + left + x] = 40;
+        }
+      }
+    }
+  }
+}
+
+static int decodes(struct quirc* q, const char* payload) {
+  static struct quirc_code code;
+  static struct quirc_data data;
+  int i;
+
+  for (i = 0; i < quirc_count(q); i++) {
+    quirc_extract(q, i, &code);
+    if (!quirc_decode(&code, &data) && !strcmp((const char*)data.payload, payload)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int run(const struct track_scene* scene, enum input_mode mode, int pyramid, const struct track_codes* codes) {
+  static uint8_t frame[TRACK_W * TRACK_H];
+  struct quirc* q = quirc_new();
+  int failed = 0;
+  int f, i;
+
+  if (!q || quirc_resize(q, TRACK_W, TRACK_H) < 0 || quirc_set_pyramid(q, pyramid) < 0
+      || (mode == INPUT_SEPARATE && quirc_set_separate_labels(q, 1) < 0)) {
+    fprintf(stderr, "can't set up the recognizer\n");
+    quirc_destroy(q);
+    return 1;
+  }
+  quirc_set_tracking(q, 1);
+
+  for (f = 0; f < scene->frames; f++) {
+    const struct track_frame* tf = &scene->frame[f];
+
+    draw_frame(frame, codes, tf);
+    if (mode == INPUT_BORROWED) {
+      quirc_begin_borrowed(q, frame);
+    } else {
+      memcpy(quirc_begin(q, NULL, NULL), frame, sizeof(frame));
+    }
+    quirc_end(q);
+
+    for (i = 0; i < TRACK_MAX_CODES; i++) {
+      if (tf->pos[i][0] >= 0 && !decodes(q, payloads[i])) {
+        printf("FAIL: %s, %s, coarse pass 1/%d: frame %d, code \"%s\" at (%d,%d) not decoded, %d grids found\n",
+               scene->name, input_names[mode], pyramid, f, payloads[i], tf->pos[i][0], tf->pos[i][1],
+               quirc_count(q));
+        failed = 1;
+      }
+    }
+  }
+
+  quirc_destroy(q);
+  return failed;
+}
+
+int main(void) {
+  static struct track_codes codes;
+  int failed = 0;
+  int s, mode, i;
+
+  for (i = 0; i < TRACK_MAX_CODES; i++) {
+    codes.size = qr_synth_encode((const uint8_t*)payloads[i], strlen(payloads[i]), TRACK_VERSION, 0, 0, codes.grid[i]);
+    if (codes.size < 0) {
+      fprintf(stderr, "can't encode the test codes\n");
+      return 1;
+    }
+  }
+
+  for (s = 0; s < TRACK_SCENES; s++) {
+    for (mode = 0; mode < INPUT_MODES; mode++) {
+      failed |= run(&scenes[s], (enum input_mode)mode, 1, &codes);
+      failed |= run(&scenes[s], (enum input_mode)mode, 2, &codes);
+    }
+  }
+
+  if (!failed) {
+    printf("every code decoded in every frame\n");
+  }
+  return failed;
+}
@@ -0,0 +1,175 @@
+/* Compares the region limits of the two labelling modes on busy frames.
+ *
+ *   region_bench [frames]
+ *
+ * Each frame is covered in barcode labels, whose bars keep passing the
+ * finder ratio test and use up regions, with a row of finder patterns
+ * underneath. Flood filling is held to the 254 codes of the 8-bit label
+ * plane. Run labelling is shown at that limit and with a pool sized to
+ * the frame. For every camera resolution it prints the time per frame,
+ * the regions used, the finder patterns found and the bytes spent on
+ * labels.
+ */
+
+#include "../quirc/quirc_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_FINDERS           6
+#define BENCH_MODULE            3
+#define BENCH_PIXELS_PER_REGION 256
+
+struct bench_mode {
+  const char* name;
+  int run_labels;
+  int pooled;
+};
+
+static const struct bench_mode modes[] = {
+    {"flood", 0, 0},
+    {"runs", 1, 0},
+    {"runs+pool", 1, 1},
+};
+
+static const int sizes[][2] = {{320, 240}, {640, 480}, {800, 600}, {1600, 1200}};
+
+static uint32_t rng_state;
+
+static int rng(int n) {
+  rng_state = rng_state * 1103515245 + 12345;
+  return (rng_state >> 16) % n;
+}
+
+static void fill(uint8_t* img, int w, int x, int y, int rw, int rh, uint8_t v) {
+  int i;
+
+  for (i = 0; i < rh; i++) {
+    memset(img + (y + i) * w + x, v, rw);
+  }
+}
+
+/* Labels of bars 1-4 and gaps 1-2 modules of two pixels wide, in rows down to
+ * the given height
+ */
+static void draw_labels(uint8_t* img, int w, int bottom) {
+  int y;
+
+  for (y = 8; y + 40 < bottom; y += 48) {
+    int x = 8;
+
+    while (x + 96 < w) {
+      int end = x + 64 + rng(w / 4);
+      int bx = x + 4;
+
+      if (end > w - 8) {
+        end = w - 8;
+      }
+      fill(img, w, x, y, end - x, 40, 240);
+      while (bx + 8 < end) {
+        int bar = 2 + rng(4) * 2;
+
+        fill(img, w, bx, y + 4, bar, 32, 20);
+        bx += bar + 2 + rng(2) * 2;
+      }
+      x = end + 12;
+    }
+  }
+}
+
+static void draw_finder(uint8_t* img, int w, int x, int y) {
+  fill(img, w, x - BENCH_MODULE, y - BENCH_MODULE, 9 * BENCH_MODULE, 9 * BENCH_MODULE, 240);
+  fill(img, w, x, y, 7 * BENCH_MODULE, 7 * BENCH_MODULE, 20);
+  fill(img, w, x + BENCH_MODULE, y + BENCH_MODULE, 5 * BENCH_MODULE, 5 * BENCH_MODULE, 240);
+  fill(img, w, x + 2 * BENCH_MODULE, y + 2 * BENCH_MODULE, 3 * BENCH_MODULE, 3 * BENCH_MODULE, 20);
+}
+
+static void draw_frame(uint8_t* img, int w, int h) {
+  int bottom = h - 12 * BENCH_MODULE;
+  int i;
+
+  rng_state = w * h;
+  memset(img, 160, w * h);
+  draw_labels(img, w, bottom);
+  for (i = 0; i < BENCH_FINDERS; i++) {
+    draw_finder(img, w, (i * 2 + 1) * w / (BENCH_FINDERS * 2) - 4 * BENCH_MODULE, bottom + 2 * BENCH_MODULE);
+  }
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Region pool plus run table, the memory that grows with busy frames */
+static long label_bytes(const struct quirc* q) {
+  long bytes = (long)q->regions_len * sizeof(struct quirc_region);
+
+  if (q->runs) {
+    bytes += (long)q->runs_len * sizeof(struct quirc_run) + (q->frame_h + 1) * sizeof(int);
+  }
+  return bytes;
+}
+
+static int run_mode(const struct bench_mode* mode, const uint8_t* img, int w, int h, int frames) {
+  struct quirc* q = quirc_new();
+  double start, elapsed;
+  int i;
+
+  if (!q || quirc_set_packed_scan(q, 1) < 0 || quirc_set_run_labels(q, mode->run_labels) < 0
+      || quirc_set_threshold(q, QUIRC_THRESHOLD_BOX) < 0 || quirc_resize(q, w, h) < 0) {
+    fprintf(stderr, "can't set up %s at %dx%d\n", mode->name, w, h);
+    quirc_destroy(q);
+    return -1;
+  }
+  if (mode->pooled) {
+    quirc_set_max_regions(q, w * h / BENCH_PIXELS_PER_REGION);
+  }
+
+  start = now_ms();
+  for (i = 0; i < frames; i++) {
+    quirc_begin_borrowed(q, img);
+    quirc_end(q);
+  }
+  elapsed = now_ms() - start;
+
+  printf("%4dx%-4d  %-9s  %8.2f  %7d  %5d/%d  %8ld\n", w, h, mode->name, elapsed / frames, q->num_regions,
+         q->num_capstones, BENCH_FINDERS, label_bytes(q));
+
+  quirc_destroy(q);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 20;
+  unsigned i, j;
+
+  if (frames < 1) {
+    frames = 1;
+  }
+
+  printf("frame      mode       ms/frame  regions  finders  label bytes\n");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    int w = sizes[i][0];
+    int h = sizes[i][1];
+    uint8_t* img = malloc(w * h);
+
+    if (!img) {
+      return 1;
+    }
+    draw_frame(img, w, h);
+    for (j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+      if (run_mode(&modes[j], img, w, h, frames) < 0) {
+        free(img);
+        return 1;
+      }
+    }
+    free(img);
+  }
+
+  return 0;
+}
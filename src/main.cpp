@@ -6,7 +6,15 @@
 #include <WebServer.h>
 #include <WiFi.h>
 #include <WiFiClient.h>
-
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+#include "pipeline/metrics.h"
+#include "pipeline/pipeline.h"
+#include "pipeline/seen_codes.h"
 #include "quirc/quirc.h"
 #include "soc/rtc_cntl_reg.h"
 
@@ -22,8 +30,65 @@
 #define PICKUP_POINT_PUBLISH_BASE         "sm_iot_lab/cube_scanner"
 #define CUBE_SCANNED_PUBLISH              "cube/scanned"
 #define IP_PUBLISH                        "ip/post"
+#define TELEMETRY_PUBLISH                 "telemetry"
 #define SCANNED_PUBLISH_TOPIC             PICKUP_POINT_PUBLISH_BASE "/" PICKUP_POINT_N "/" CUBE_SCANNED_PUBLISH
 #define POST_IP_PUBLISH_TOPIC             PICKUP_POINT_PUBLISH_BASE "/" PICKUP_POINT_N "/" IP_PUBLISH
+#define TELEMETRY_PUBLISH_TOPIC           PICKUP_POINT_PUBLISH_BASE "/" PICKUP_POINT_N "/" TELEMETRY_PUBLISH
+
+// stage timings and counts of the last period, see Metrics::format_json()
+#define TELEMETRY_PERIOD_MS               60000
+// PubSubClient's default of 256 bytes is too small for a telemetry message
+#define MQTT_BUFFER_SIZE                  2048
+
+#define QRCODE_THRESHOLD_METHOD           QUIRC_THRESHOLD_BOX
+
+// decode only inside the dashed #overlay box of INDEX_HTML, in 1/10000 of the frame
+#define QRCODE_ROI_ENABLED                1
+#define QRCODE_ROI_LEFT                   2948
+#define QRCODE_ROI_TOP                    2431
+#define QRCODE_ROI_WIDTH                  4000
+#define QRCODE_ROI_HEIGHT                 5000
+
+/* Busy scenes need about one region per this many pixels of the area
+ * quirc scans. Flood filling is faster and lighter than run labelling,
+ * but can't label more than quirc's default of 254, so runs are only
+ * used for areas that need more.
+ */
+#define QRCODE_PIXELS_PER_REGION          256
+#define QRCODE_FLOOD_FILL_REGIONS         254
+
+/* The 4 MB of PSRAM hold the framebuffers, the luma image and quirc's
+ * planes: about 1.6 MB at SVGA, 2.7 MB at XGA and 3.1 MB at HD
+ * (1280x720), the largest frame size that fits. SXGA and UXGA need 4.4
+ * and 6.5 MB. The run table, counting the old one held while it grows,
+ * is limited to this, which still fits at HD and holds a run every 8
+ * pixels of its ROI. Busier scenes are flood filled.
+ */
+#define QRCODE_RUN_TABLE_BYTES            (1024 * 1024)
+
+// look for cubes at half resolution first, their capstones span dozens of pixels
+#define QRCODE_PYRAMID_SCALE              2
+
+#define STREAM_JPEG_QUALITY               80
+
+/* The sensor compresses frames itself, so the stream costs no CPU. The
+ * decoder unpacks the luma of the frames it is given, and change
+ * detection uses a preview built from the DC coefficients only. Set to 0
+ * to capture grayscale and encode the stream in software instead.
+ */
+#define CAMERA_HARDWARE_JPEG              1
+#define CAMERA_JPEG_QUALITY               12
+/* Frames are handed to the consumers in the driver's own framebuffers,
+ * so capture only goes on while one is free: one being filled, one for
+ * each consumer and one queued
+ */
+#define CAMERA_FB_COUNT                   4
+/* JPG_SCALE_2X halves the size of the image quirc sees, which halves its
+ * time but loses small codes. On synthetic SVGA frames of versions 1 to
+ * 10 after a JPEG round trip, it decoded 289 of 320 instead of 309 when
+ * codes filled 60% of the height, and 75 instead of 249 at 30%.
+ */
+#define QRCODE_JPEG_SCALE                 JPG_SCALE_NONE
 
 static const char PROGMEM INDEX_HTML[] = R"rawliteral(
 <html><head><title></title><meta name="viewport" content="width=device-width, initial-scale=1"><style>body{margin:auto;}img{position:relative;width:384px;height:288px;}#overlay{position:absolute;top:24.31%;left:29.48%;width:40%;height:50%;border:dashed red 2px;}#container{position:absolute;margin-left:calc(50% - 192px);margin-top:10px;}</style></head><body><div id="container"><img src="" id="vdstream"><div id="overlay"></div></div><script>window.onload=document.getElementById("vdstream").src=window.location.href.slice(0, -1) + ":80/stream";</script></body></html>
@@ -35,6 +100,8 @@ WebServer server(80);
 
 WiFiClient client;
 PubSubClient mqttClient(client);
+// the decode task publishes while loop() services the connection
+std::mutex mqtt_mutex;
 
 struct QRCodeData {
   bool valid;
@@ -42,22 +109,19 @@ struct QRCodeData {
   uint8_t payload[1024];
   int payloadLen;
 };
-struct quirc* q = quirc_new();
-uint8_t* image = NULL;
+struct quirc* q = NULL;
 struct quirc_code code;
 struct quirc_data data;
-char last_qrcode_data[8896];
+// kept for the lifetime of the firmware so decoding doesn't allocate
+struct quirc_decode_scratch decode_scratch;
 
 StaticJsonDocument<200> doc;
 
-static void dumpData(const struct quirc_data* data) {
-  ESP_LOGD(TAG, "Payload: %s\n", data->payload);
-  if (strcmp(last_qrcode_data, (char*)data->payload) == 0) {
-    ESP_LOGD(TAG, "new payload is the same as the old, skipping");
-    return;
-  }
+static Metrics metrics;
+
+static SeenCodes seen_codes;
 
-  // if (mqttClient.connected()) {
+static bool publish_qrcode(const struct quirc_data* data) {
   StaticJsonDocument<200> qrCodeDoc;
   qrCodeDoc["pickupPointN"] = PICKUP_POINT_N_INT;
   qrCodeDoc["payload"] = (char*)data->payload;
@@ -65,104 +129,386 @@ static void dumpData(const struct quirc_data* data) {
   uint8_t* output = (uint8_t*)malloc(doc_size);
 
   serializeJson(qrCodeDoc, (void*)output, doc_size);
-  bool res = mqttClient.publish(SCANNED_PUBLISH_TOPIC, output, doc_size);
+  bool res;
+  {
+    StageTimer timer(metrics, METRIC_PUBLISH);
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    res = mqttClient.publish(SCANNED_PUBLISH_TOPIC, output, doc_size);
+  }
 
   free(output);
+  metrics.count(res ? METRIC_PUBLISHED : METRIC_PUBLISH_FAILED);
   if (res) {
     ESP_LOGD(TAG, "qr code payload published");
-    memcpy(&last_qrcode_data, data->payload, data->payload_len);
-    // } else {
-    //   ESP_LOGD(TAG, "could not publish qr code payload");
-    // }
   } else {
     ESP_LOGD(TAG, "qrcode payload NOT published");
   }
+  return res;
 }
 
-void try_qrcode_decode(uint8_t* buffer, int width, int height, int size) {
-  q = quirc_new();
+/* The recognizer is created on first use and kept for the lifetime of the
+ * firmware. quirc_resize() only reallocates when the camera geometry changes.
+ */
+static bool qrcode_session_prepare(int width, int height) {
   if (q == NULL) {
-    ESP_LOGD(TAG, "can't create quirc object\r\n");
+    q = quirc_new();
+    if (q == NULL) {
+      ESP_LOGD(TAG, "can't create quirc object\r\n");
+      return false;
+    }
+
+    if (quirc_set_packed_scan(q, 1) < 0) {
+      ESP_LOGD(TAG, "can't enable packed finder scan\r\n");
+    }
+
+    quirc_set_max_run_bytes(q, QRCODE_RUN_TABLE_BYTES);
+
+    if (quirc_set_threshold(q, QRCODE_THRESHOLD_METHOD) < 0) {
+      ESP_LOGD(TAG, "can't select threshold method, using default\r\n");
+    }
+
+    // a cube usually stays in view for many frames, look where it was first
+    quirc_set_tracking(q, 1);
+
+    if (quirc_set_pyramid(q, QRCODE_PYRAMID_SCALE) < 0) {
+      ESP_LOGD(TAG, "can't set up coarse pass, scanning at full resolution\r\n");
+    }
+
+    quirc_set_stage_clock(q, Metrics::cycles);
+    decode_scratch.clock = Metrics::cycles;
+  }
+
+  if (quirc_resize(q, width, height) < 0) {
+    ESP_LOGD(TAG, "can't resize quirc object to %dx%d\r\n", width, height);
+    return false;
+  }
+
+  int area = width * height;
+#if QRCODE_ROI_ENABLED
+  area = (width * QRCODE_ROI_WIDTH / 10000) * (height * QRCODE_ROI_HEIGHT / 10000);
+#endif
+  int max_regions = area / QRCODE_PIXELS_PER_REGION;
+  bool run_labels = max_regions > QRCODE_FLOOD_FILL_REGIONS;
+
+  // flood filling can only be set back once the limit is down to its default
+  if (!run_labels) {
+    quirc_set_max_regions(q, QRCODE_FLOOD_FILL_REGIONS);
+  }
+  if (quirc_set_run_labels(q, run_labels) < 0) {
+    ESP_LOGD(TAG, "can't switch run labelling %s for %dx%d\r\n", run_labels ? "on" : "off", width, height);
+  } else if (run_labels && quirc_set_max_regions(q, max_regions) < 0) {
+    ESP_LOGD(TAG, "can't raise region limit for %dx%d\r\n", width, height);
+  }
+
+#if QRCODE_ROI_ENABLED
+  quirc_set_roi(
+      q, width * QRCODE_ROI_LEFT / 10000, height * QRCODE_ROI_TOP / 10000, width * QRCODE_ROI_WIDTH / 10000,
+      height * QRCODE_ROI_HEIGHT / 10000
+  );
+#endif
+
+  return true;
+}
+
+void try_qrcode_decode(uint8_t* buffer, int width, int height, int size) {
+  if (size < width * height) {
+    ESP_LOGD(TAG, "frame is not grayscale, skipping decode\r\n");
+    return;
+  }
+
+  if (!qrcode_session_prepare(width, height)) {
     return;
   }
 
-  quirc_resize(q, width, height);
-  image = quirc_begin(q, NULL, NULL);
-  memcpy(image, buffer, size);
+  // the framebuffer is only read, so it can still be streamed afterwards
+  quirc_begin_borrowed(q, buffer);
   quirc_end(q);
+  for (int i = 0; i < QUIRC_STAGE_COUNT; i++) {
+    metrics.record((MetricStage)(METRIC_THRESHOLD + i), quirc_stage_ticks(q, (quirc_stage_t)i));
+  }
 
   int count = quirc_count(q);
-  if (count > 0) {
-    quirc_extract(q, 0, &code);
-    quirc_decode_error_t err = quirc_decode(&code, &data);
+  metrics.count(METRIC_CODES_FOUND, count);
+  int decoded = 0;
+  seen_codes.begin_frame();
+
+  // every cube in view is published as its own event
+  for (int i = 0; i < count; i++) {
+    uint32_t start = Metrics::cycles();
+    quirc_extract(q, i, &code);
+    uint32_t extracted = Metrics::cycles();
+    quirc_decode_error_t err = quirc_decode_with_scratch(&code, &data, &decode_scratch);
+    metrics.record(METRIC_EXTRACT, extracted - start);
+    metrics.record(METRIC_DECODE, Metrics::cycles() - extracted);
+    if (decode_scratch.ecc_ticks) {
+      metrics.record(METRIC_ECC, decode_scratch.ecc_ticks);
+    }
 
     if (err) {
-      ESP_LOGD(TAG, "Decoding FAILED\n");
+      metrics.count(METRIC_DECODE_FAILED);
+      ESP_LOGD(TAG, "Decoding FAILED: %s\n", quirc_strerror(err));
+      continue;
+    }
+    decoded++;
+    metrics.count(METRIC_CODES_DECODED);
+
+    ESP_LOGD(TAG, "Payload: %s\n", data.payload);
+    if (seen_codes.is_new(data.payload, data.payload_len)) {
+      // not remembered on failure, so it is retried with the next frame
+      if (!publish_qrcode(&data)) {
+        continue;
+      }
     } else {
-      dumpData(&data);
+      ESP_LOGD(TAG, "payload was already published, skipping");
     }
+    seen_codes.mark(data.payload, data.payload_len);
   }
 
-  quirc_destroy(q);
-  image = NULL;
+  seen_codes.end_frame(decoded);
 }
 
-void handle_index(void) { server.send(200, "text/html", INDEX_HTML); }
+/* Grayscale image grown to the largest size it has held, in PSRAM */
+struct LumaImage {
+  uint8_t* buf;
+  size_t capacity;
+  int width;
+  int height;
 
-void handle_jpg_stream(void) {
-  ESP_LOGD(TAG, "Stream start");
+  LumaImage() : buf(NULL), capacity(0), width(0), height(0) {}
+};
+
+/* Only the region of the image quirc reads is converted. It is given in
+ * 1/10000 of the image and turned into pixels once the size is known.
+ */
+struct JpegLumaJob {
+  const uint8_t* jpeg;
+  LumaImage* out;
+  int region[4];
+  int rect[4];
+};
 
-  WiFiClient client = server.client();
-  String response = "HTTP/1.1 200 OK\r\n";
-  response += "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
-  server.sendContent(response);
+static size_t jpeg_read(void* arg, size_t index, uint8_t* buf, size_t len) {
+  JpegLumaJob* job = (JpegLumaJob*)arg;
+  if (buf != NULL) {
+    memcpy(buf, job->jpeg + index, len);
+  }
+  return len;
+}
 
-  response = "--frame\r\n";
-  response += "Content-Type: image/jpeg\r\n\r\n";
+// the decoder hands over RGB888 blocks, with no data at the start and the end
+static bool luma_write(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data) {
+  JpegLumaJob* job = (JpegLumaJob*)arg;
+  LumaImage* out = job->out;
 
-  uint8_t frames = 0;
-  size_t _jpg_buf_len = 0;
-  uint8_t* _jpg_buf = NULL;
+  if (data == NULL) {
+    if (x != 0 || y != 0) {
+      return true;
+    }
+    if ((size_t)w * h > out->capacity) {
+      free(out->buf);
+      out->buf = (uint8_t*)ps_malloc((size_t)w * h);
+      out->capacity = out->buf != NULL ? (size_t)w * h : 0;
+      if (out->buf == NULL) {
+        return false;
+      }
+    }
+    out->width = w;
+    out->height = h;
+    job->rect[0] = w * job->region[0] / 10000;
+    job->rect[1] = h * job->region[1] / 10000;
+    // rounded like the region of interest given to quirc
+    job->rect[2] = job->rect[0] + w * job->region[2] / 10000;
+    job->rect[3] = job->rect[1] + h * job->region[3] / 10000;
+    return true;
+  }
 
-  uint8_t* buffer = NULL;
-  int width = 0;
-  int height = 0;
-  size_t size = 0;
+  if (out->buf == NULL || x + w > out->width || y + h > out->height) {
+    return false;
+  }
 
-  bool jpeg_converted = false;
+  int left = x > job->rect[0] ? x : job->rect[0];
+  int top = y > job->rect[1] ? y : job->rect[1];
+  int right = x + w < job->rect[2] ? x + w : job->rect[2];
+  int bottom = y + h < job->rect[3] ? y + h : job->rect[3];
+  for (int row = top; row < bottom; row++) {
+    const uint8_t* src = data + ((row - y) * w + left - x) * 3;
+    uint8_t* dst = out->buf + row * out->width;
+    for (int col = left; col < right; col++, src += 3) {
+      dst[col] = (src[0] * 77 + src[1] * 150 + src[2] * 29) >> 8;
+    }
+  }
+  return true;
+}
 
-  while (1) {
-    mqttClient.loop();
-    frames++;
+// pixels outside the region, in 1/10000 of the image, are left as they were
+static bool jpeg_to_luma(
+    const uint8_t* jpeg, size_t len, jpg_scale_t scale, LumaImage& out, int left = 0, int top = 0, int width = 10000,
+    int height = 10000
+) {
+  JpegLumaJob job = {jpeg, &out, {left, top, width, height}, {0, 0, 0, 0}};
+  return esp_jpg_decode(len, scale, jpeg_read, luma_write, &job) == ESP_OK;
+}
 
-    cam.run();
-    if (!client.connected()) {
-      break;
+class CameraFrameSource : public FrameSource
+{
+public:
+  // takes the framebuffer from the driver, the pipeline holds it until every consumer is done with it
+  bool grab(FrameView& view) override {
+    camera_fb_t* fb;
+    {
+      StageTimer timer(metrics, METRIC_CAPTURE);
+      fb = esp_camera_fb_get();
     }
-    server.sendContent(response);
 
-    buffer = cam.getfb();
-    width = cam.getWidth();
-    height = cam.getHeight();
-    size = cam.getSize();
+    if (fb == NULL) {
+      ESP_LOGD(TAG, "camera capture failed");
+      return false;
+    }
 
-    // perform qr code decode every 5 frames
-    if (frames == 5) {
-      try_qrcode_decode(buffer, width, height, size);
-      frames = 0;
+    view.buf = fb->buf;
+    view.len = fb->len;
+    view.width = fb->width;
+    view.height = fb->height;
+    view.format = fb->format;
+    view.handle = fb;
+    return true;
+  }
+
+  void recycle(void* handle) override { esp_camera_fb_return((camera_fb_t*)handle); }
+
+  // an eighth of the size, which the JPEG decoder takes from the DC coefficients alone
+  const uint8_t* preview(const Frame& frame, int& width, int& height) override {
+    if (frame.format != PIXFORMAT_JPEG) {
+      return NULL;
+    }
+
+    StageTimer timer(metrics, METRIC_PREVIEW);
+    if (!jpeg_to_luma(frame.buf, frame.len, JPG_SCALE_8X, preview_)) {
+      return NULL;
+    }
+    width = preview_.width;
+    height = preview_.height;
+    return preview_.buf;
+  }
+
+private:
+  LumaImage preview_;
+};
+
+class QRCodeDecodeSink : public FrameSink
+{
+public:
+  void consume(const Frame& frame) override {
+    if (frame.format != PIXFORMAT_JPEG) {
+      try_qrcode_decode(frame.buf, frame.width, frame.height, frame.len);
+      return;
+    }
+
+    bool unpacked;
+    {
+      StageTimer timer(metrics, METRIC_LUMA);
+#if QRCODE_ROI_ENABLED
+      // quirc reads nothing outside its region of interest
+      unpacked = jpeg_to_luma(
+          frame.buf, frame.len, QRCODE_JPEG_SCALE, luma_, QRCODE_ROI_LEFT, QRCODE_ROI_TOP, QRCODE_ROI_WIDTH,
+          QRCODE_ROI_HEIGHT
+      );
+#else
+      unpacked = jpeg_to_luma(frame.buf, frame.len, QRCODE_JPEG_SCALE, luma_);
+#endif
+    }
+    if (!unpacked) {
+      ESP_LOGD(TAG, "jpeg decoding failed");
+      return;
+    }
+    try_qrcode_decode(luma_.buf, luma_.width, luma_.height, luma_.width * luma_.height);
+  }
+
+private:
+  LumaImage luma_;
+};
+
+/* Serves the MJPEG stream of one viewer from the stream task, so the web
+ * server is free again as soon as the viewer is attached. A new viewer
+ * replaces the previous one.
+ */
+class MjpegStreamSink : public FrameSink
+{
+public:
+  MjpegStreamSink() : attached_(false) {}
+
+  void attach(WiFiClient& viewer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (attached_) {
+      viewer_.stop();
+    }
+    viewer_ = viewer;
+    attached_ = true;
+  }
+
+  bool wants_frames() override { return attached_; }
+
+  void consume(const Frame& frame) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!attached_) {
+      return;
+    }
+
+    if (!viewer_.connected()) {
+      ESP_LOGD(TAG, "Stream end");
+      viewer_.stop();
+      attached_ = false;
+      return;
+    }
+
+    uint8_t* jpg_buf = frame.buf;
+    size_t jpg_buf_len = frame.len;
+    if (frame.format != PIXFORMAT_JPEG) {
+      StageTimer timer(metrics, METRIC_JPEG);
+      bool jpeg_converted = fmt2jpg(
+          frame.buf, frame.len, frame.width, frame.height, (pixformat_t)frame.format, STREAM_JPEG_QUALITY, &jpg_buf,
+          &jpg_buf_len
+      );
+      if (!jpeg_converted) {
+        ESP_LOGD(TAG, "jpeg conversion failed");
+        return;
+      }
     }
-    jpeg_converted = frame2jpg(cam.getCameraFb(), 80, &_jpg_buf, &_jpg_buf_len);
 
-    client.write((char*)_jpg_buf, _jpg_buf_len);
-    server.sendContent("\r\n");
-    free(_jpg_buf);
+    viewer_.print("--frame\r\nContent-Type: image/jpeg\r\n\r\n");
+    viewer_.write(jpg_buf, jpg_buf_len);
+    viewer_.print("\r\n");
 
-    if (!client.connected()) {
-      break;
+    if (jpg_buf != frame.buf) {
+      free(jpg_buf);
     }
   }
 
-  ESP_LOGD(TAG, "Stream end");
+private:
+  std::mutex mutex_;
+  WiFiClient viewer_;
+  std::atomic<bool> attached_;
+};
+
+static CameraFrameSource camera_source;
+static QRCodeDecodeSink qrcode_sink;
+static MjpegStreamSink stream_sink;
+static FramePipeline pipeline(camera_source, qrcode_sink, stream_sink);
+
+void handle_index(void) { server.send(200, "text/html", INDEX_HTML); }
+
+void handle_metrics(void) {
+  std::string text;
+  metrics.format_text(text, pipeline.stats());
+  server.send(200, "text/plain; version=0.0.4", text.c_str());
+}
+
+void handle_jpg_stream(void) {
+  ESP_LOGD(TAG, "Stream start");
+
+  WiFiClient viewer = server.client();
+  viewer.print("HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n");
+  stream_sink.attach(viewer);
 }
 
 void on_mqtt_message_received(char* topic, byte* payload, unsigned int length) {
@@ -174,7 +520,12 @@ void on_mqtt_message_received(char* topic, byte* payload, unsigned int length) {
 }
 
 void mqtt_connect() {
-  while (!mqttClient.connected()) {
+  while (1) {
+    std::unique_lock<std::mutex> lock(mqtt_mutex);
+    if (mqttClient.connected()) {
+      return;
+    }
+
     ESP_LOGD(TAG, "Attempting MQTT connection");
     if (mqttClient.connect("cube-scanner-" SCANNER_N, "sm_iot_lab/scanner/" SCANNER_N "/status", 2, true, "down")) {
       ESP_LOGD(TAG, "MQTT connection established");
@@ -192,11 +543,34 @@ void mqtt_connect() {
       free(output);
     } else {
       ESP_LOGD(TAG, "MQTT connection failed, status=Try again in seconds");
+      lock.unlock();
       delay(WAIT_TIME_BEFORE_CONNECTION_RETRY);
     }
   }
 }
 
+// the message is built before taking mqtt_mutex, so a publishing decoder only waits for the send
+static void publish_telemetry() {
+  static MetricsSnapshot before;
+  MetricsSnapshot now;
+  std::string json;
+  bool res;
+
+  metrics.snapshot(now);
+  Metrics::format_json(json, now, before, pipeline.stats());
+  {
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    res = mqttClient.publish(TELEMETRY_PUBLISH_TOPIC, json.c_str());
+  }
+
+  // after a failure the next message covers this period as well
+  if (res) {
+    before = now;
+  } else {
+    ESP_LOGD(TAG, "telemetry NOT published");
+  }
+}
+
 void setup() {
   // Disable brownout detector.
   WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0);
@@ -207,7 +581,17 @@ void setup() {
   while (!Serial) {
     ;
   }
-  cam.init(esp32cam_aithinker_config);
+  camera_config_t camera_config = esp32cam_aithinker_config;
+#if CAMERA_HARDWARE_JPEG
+  camera_config.pixel_format = PIXFORMAT_JPEG;
+  camera_config.jpeg_quality = CAMERA_JPEG_QUALITY;
+#else
+  camera_config.pixel_format = PIXFORMAT_GRAYSCALE;
+#endif
+  camera_config.fb_count = CAMERA_FB_COUNT;
+  // frames that wait in a free framebuffer are replaced by newer ones
+  camera_config.grab_mode = CAMERA_GRAB_LATEST;
+  cam.init(camera_config);
 
   WiFi.mode(WIFI_STA);
   WiFi.begin(ssid, password);
@@ -216,11 +600,21 @@ void setup() {
   }
 
   server.on("/stream", HTTP_GET, handle_jpg_stream);
+  server.on("/metrics", HTTP_GET, handle_metrics);
   server.on("/", HTTP_GET, handle_index);
   server.begin();
 
   mqttClient.setServer(BROKER_IP, BROKER_PORT);
   mqttClient.setCallback(on_mqtt_message_received);
+  mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+
+#if QRCODE_ROI_ENABLED
+  // only a change inside the overlay box can bring a code to decode
+  pipeline.set_scene_region(QRCODE_ROI_LEFT, QRCODE_ROI_TOP, QRCODE_ROI_WIDTH, QRCODE_ROI_HEIGHT);
+#endif
+
+  // capture and stream on the loop() core, decode on the other one
+  pipeline.start();
 }
 
 void loop() {
@@ -230,5 +624,14 @@ void loop() {
     mqtt_connect();
   }
 
-  mqttClient.loop();
+  {
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    mqttClient.loop();
+  }
+
+  static uint32_t last_telemetry = 0;
+  if (millis() - last_telemetry >= TELEMETRY_PERIOD_MS) {
+    last_telemetry = millis();
+    publish_telemetry();
+  }
 }
@@ -0,0 +1,213 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifdef ESP_PLATFORM
+#include "esp32/rom/ets_sys.h"
+#include "xtensa/hal.h"
+#else
+#include <chrono>
+#endif
+
+static const char* const stage_names[METRIC_STAGE_COUNT] = {
+    "capture", "preview", "jpeg", "luma", "threshold", "label", "finders", "grids", "extract", "decode", "ecc", "publish",
+};
+
+static const char* const counter_names[METRIC_COUNTER_COUNT] = {
+    "codes_found", "codes_decoded", "decode_failed", "published", "publish_failed",
+};
+
+static int bucket_index(uint32_t us) {
+  if (us <= 1u << METRICS_FIRST_BUCKET) {
+    return 0;
+  }
+
+  // bits needed for us - 1 is the log2 of the smallest power of two not below us
+  int i = 32 - __builtin_clz(us - 1) - METRICS_FIRST_BUCKET;
+  return i < METRICS_BUCKETS - 1 ? i : METRICS_BUCKETS - 1;
+}
+
+StageHistogram::StageHistogram() : count_(0), sum_us_(0), max_us_(0) {
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    buckets_[i] = 0;
+  }
+}
+
+void StageHistogram::record(uint32_t us) {
+  buckets_[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(us, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+
+  uint32_t max = max_us_.load(std::memory_order_relaxed);
+  while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+}
+
+void StageHistogram::snapshot(StageSnapshot& out) const {
+  // fields are read one at a time, a record in between only skews them by one
+  out.count = count_.load(std::memory_order_relaxed);
+  out.sum_us = sum_us_.load(std::memory_order_relaxed);
+  out.max_us = max_us_.load(std::memory_order_relaxed);
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    out.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+}
+
+Metrics::Metrics() {
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    counters_[i] = 0;
+  }
+}
+
+uint32_t Metrics::cycles() {
+#ifdef ESP_PLATFORM
+  return xthal_get_ccount();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+static uint32_t cycles_per_us() {
+#ifdef ESP_PLATFORM
+  // read every time, the CPU clock may have been changed
+  return ets_get_cpu_frequency();
+#else
+  return 1000;
+#endif
+}
+
+void Metrics::record(MetricStage stage, uint32_t cycles) { stages_[stage].record(cycles / cycles_per_us()); }
+
+void Metrics::snapshot(MetricsSnapshot& out) const {
+  for (int i = 0; i < METRIC_STAGE_COUNT; i++) {
+    stages_[i].snapshot(out.stages[i]);
+  }
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    out.counters[i] = counters_[i].load(std::memory_order_relaxed);
+  }
+}
+
+static void appendf(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string& out, const char* fmt, ...) {
+  char line[128];
+  va_list args;
+
+  va_start(args, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+
+  if (len > 0) {
+    out.append(line, len < (int)sizeof(line) ? len : sizeof(line) - 1);
+  }
+}
+
+// fmt takes a separator, which is sep for all but the first, the name and the value
+static void append_pipeline_stats(std::string& out, const PipelineStats& pipeline, const char* fmt, const char* sep) {
+  const struct {
+    const char* name;
+    uint32_t value;
+  } stats[] = {
+      {"captured", pipeline.captured},
+      {"capture_failed", pipeline.capture_failed},
+      {"pool_exhausted", pipeline.pool_exhausted},
+      {"decoded", pipeline.decoded},
+      {"decode_dropped", pipeline.decode_dropped},
+      {"decode_skipped", pipeline.decode_skipped},
+      {"streamed", pipeline.streamed},
+      {"stream_dropped", pipeline.stream_dropped},
+      {"idle_frames", pipeline.idle_frames},
+  };
+
+  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+    appendf(out, fmt, i ? sep : "", stats[i].name, (unsigned)stats[i].value);
+  }
+}
+
+void Metrics::format_text(std::string& out, const PipelineStats& pipeline) const {
+  MetricsSnapshot now;
+  snapshot(now);
+
+  out += "# TYPE scanner_stage_us histogram\n";
+  for (int i = 0; i < METRIC_STAGE_COUNT; i++) {
+    const StageSnapshot& stage = now.stages[i];
+    uint32_t cumulative = 0;
+
+    for (int b = 0; b < METRICS_BUCKETS - 1; b++) {
+      cumulative += stage.buckets[b];
+      appendf(out, "scanner_stage_us_bucket{stage=\"%s\",le=\"%u\"} %u\n", stage_names[i],
+              1u << (METRICS_FIRST_BUCKET + b), (unsigned)cumulative);
+    }
+    appendf(out, "scanner_stage_us_bucket{stage=\"%s\",le=\"+Inf\"} %u\n", stage_names[i], (unsigned)stage.count);
+    appendf(out, "scanner_stage_us_sum{stage=\"%s\"} %u\n", stage_names[i], (unsigned)stage.sum_us);
+    appendf(out, "scanner_stage_us_count{stage=\"%s\"} %u\n", stage_names[i], (unsigned)stage.count);
+  }
+
+  out += "# TYPE scanner_stage_max_us gauge\n";
+  for (int i = 0; i < METRIC_STAGE_COUNT; i++) {
+    appendf(out, "scanner_stage_max_us{stage=\"%s\"} %u\n", stage_names[i], (unsigned)now.stages[i].max_us);
+  }
+
+  out += "# TYPE scanner_events_total counter\n";
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    appendf(out, "scanner_events_total{event=\"%s\"} %u\n", counter_names[i], (unsigned)now.counters[i]);
+  }
+
+  out += "# TYPE scanner_frames_total counter\n";
+  append_pipeline_stats(out, pipeline, "%sscanner_frames_total{event=\"%s\"} %u\n", "");
+  appendf(out, "# TYPE scanner_idle gauge\nscanner_idle %d\n", pipeline.idle ? 1 : 0);
+}
+
+/* Estimates a quantile from bucket counts, interpolating inside the bucket
+ * it falls in. Counts are differences between two snapshots.
+ */
+static uint32_t quantile_us(const uint32_t* buckets, uint32_t count, uint32_t max_us, int percent) {
+  uint32_t rank = (uint64_t)count * percent / 100;
+  uint32_t below = 0;
+
+  for (int b = 0; b < METRICS_BUCKETS; b++) {
+    if (below + buckets[b] > rank) {
+      uint32_t low = b ? 1u << (METRICS_FIRST_BUCKET + b - 1) : 0;
+      // the last bucket has no upper bound, the largest duration seen stands in
+      uint32_t high = b < METRICS_BUCKETS - 1 ? 1u << (METRICS_FIRST_BUCKET + b) : max_us > low ? max_us : low;
+
+      return low + (uint64_t)(high - low) * (rank - below) / buckets[b];
+    }
+    below += buckets[b];
+  }
+  return max_us;
+}
+
+void Metrics::format_json(std::string& out, const MetricsSnapshot& now, const MetricsSnapshot& before,
+                          const PipelineStats& pipeline) {
+  out += "{\"stages\":{";
+  for (int i = 0; i < METRIC_STAGE_COUNT; i++) {
+    const StageSnapshot& a = now.stages[i];
+    const StageSnapshot& b = before.stages[i];
+    uint32_t buckets[METRICS_BUCKETS];
+    uint32_t count = a.count - b.count;
+
+    for (int j = 0; j < METRICS_BUCKETS; j++) {
+      buckets[j] = a.buckets[j] - b.buckets[j];
+    }
+
+    appendf(out, "%s\"%s\":{\"n\":%u", i ? "," : "", stage_names[i], (unsigned)count);
+    if (count) {
+      appendf(out, ",\"mean_us\":%u,\"p50_us\":%u,\"p95_us\":%u", (unsigned)((a.sum_us - b.sum_us) / count),
+              (unsigned)quantile_us(buckets, count, a.max_us, 50), (unsigned)quantile_us(buckets, count, a.max_us, 95));
+    }
+    out += "}";
+  }
+
+  out += "},\"events\":{";
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    appendf(out, "%s\"%s\":%u", i ? "," : "", counter_names[i], (unsigned)(now.counters[i] - before.counters[i]));
+  }
+
+  // the pipeline only counts since boot
+  out += "},\"frames\":{";
+  append_pipeline_stats(out, pipeline, "%s\"%s\":%u", ",");
+  appendf(out, "},\"idle\":%s}", pipeline.idle ? "true" : "false");
+}
@@ -0,0 +1,120 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#include "pipeline.h"
+
+/* Timings and counters of the hot path, cheap enough to leave on in the
+ * field. Every stage keeps a histogram of its durations in power of two
+ * buckets of microseconds. Recording is a handful of relaxed atomic adds,
+ * so any task may record while another one reads, without a lock.
+ *
+ * Durations are taken with the CPU cycle counter on the ESP32 and with
+ * the steady clock on the host. The cycle counter is per core, so a
+ * stage has to start and end on the same core, which pinned tasks do.
+ */
+
+enum MetricStage {
+  METRIC_CAPTURE,
+  // luma preview of a JPEG frame for change detection
+  METRIC_PREVIEW,
+  // encoding a frame for the stream
+  METRIC_JPEG,
+  // decoding the luma of a JPEG frame for quirc
+  METRIC_LUMA,
+  // the stages of quirc_end(), in the order of quirc_stage_t
+  METRIC_THRESHOLD,
+  METRIC_LABEL,
+  METRIC_FINDERS,
+  METRIC_GRIDS,
+  METRIC_EXTRACT,
+  // all of quirc_decode(), error correction included
+  METRIC_DECODE,
+  METRIC_ECC,
+  METRIC_PUBLISH,
+  METRIC_STAGE_COUNT
+};
+
+enum MetricCounter {
+  METRIC_CODES_FOUND,
+  METRIC_CODES_DECODED,
+  METRIC_DECODE_FAILED,
+  METRIC_PUBLISHED,
+  METRIC_PUBLISH_FAILED,
+  METRIC_COUNTER_COUNT
+};
+
+// bucket i counts durations up to 2^(METRICS_FIRST_BUCKET + i) us, the last one everything longer
+#define METRICS_FIRST_BUCKET 4
+#define METRICS_BUCKETS      18
+
+struct StageSnapshot {
+  uint32_t count;
+  // wraps after about 71 minutes spent in the stage
+  uint32_t sum_us;
+  uint32_t max_us;
+  uint32_t buckets[METRICS_BUCKETS];
+};
+
+struct MetricsSnapshot {
+  StageSnapshot stages[METRIC_STAGE_COUNT];
+  uint32_t counters[METRIC_COUNTER_COUNT];
+};
+
+class StageHistogram
+{
+public:
+  StageHistogram();
+
+  void record(uint32_t us);
+  void snapshot(StageSnapshot& out) const;
+
+private:
+  std::atomic<uint32_t> count_;
+  std::atomic<uint32_t> sum_us_;
+  std::atomic<uint32_t> max_us_;
+  std::atomic<uint32_t> buckets_[METRICS_BUCKETS];
+};
+
+class Metrics
+{
+public:
+  Metrics();
+
+  // free running, wraps; only differences of two readings mean anything
+  static uint32_t cycles();
+
+  void record(MetricStage stage, uint32_t cycles);
+  void count(MetricCounter counter, uint32_t n = 1) { counters_[counter].fetch_add(n, std::memory_order_relaxed); }
+
+  void snapshot(MetricsSnapshot& out) const;
+
+  // Prometheus text exposition of everything since boot
+  void format_text(std::string& out, const PipelineStats& pipeline) const;
+
+  // one JSON object covering what happened between two snapshots
+  static void format_json(std::string& out, const MetricsSnapshot& now, const MetricsSnapshot& before,
+                          const PipelineStats& pipeline);
+
+private:
+  StageHistogram stages_[METRIC_STAGE_COUNT];
+  std::atomic<uint32_t> counters_[METRIC_COUNTER_COUNT];
+};
+
+/* Records the time from construction to destruction as one stage */
+class StageTimer
+{
+public:
+  StageTimer(Metrics& metrics, MetricStage stage) : metrics_(metrics), stage_(stage), start_(Metrics::cycles()) {}
+  ~StageTimer() { metrics_.record(stage_, Metrics::cycles() - start_); }
+
+private:
+  Metrics& metrics_;
+  MetricStage stage_;
+  uint32_t start_;
+};
+
+#endif
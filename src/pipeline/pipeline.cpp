@@ -0,0 +1,331 @@
+#include "pipeline.h"
+
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#include "esp_pthread.h"
+#endif
+
+// each consumer only ever wants the latest frame
+#define DECODE_QUEUE_FRAMES 1
+#define STREAM_QUEUE_FRAMES 1
+
+#define CAPTURE_STACK_SIZE  4096
+#define DECODE_STACK_SIZE   16384
+#define STREAM_STACK_SIZE   8192
+
+// how often idle tasks check whether the pipeline was stopped
+#define IDLE_POLL_MS        100
+
+static uint8_t* frame_alloc(size_t len) {
+#ifdef ESP_PLATFORM
+  // frames are far too large for internal RAM
+  return (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+  return (uint8_t*)malloc(len);
+#endif
+}
+
+FramePool::~FramePool() {
+  for (int i = 0; i < PIPELINE_POOL_FRAMES; i++) {
+    free(frames_[i].storage);
+  }
+}
+
+Frame* FramePool::take() {
+  for (int i = 0; i < PIPELINE_POOL_FRAMES; i++) {
+    Frame* frame = &frames_[i];
+    int idle = 0;
+
+    if (frame->refs.compare_exchange_strong(idle, 1)) {
+      return frame;
+    }
+  }
+
+  return NULL;
+}
+
+Frame* FramePool::acquire(size_t len) {
+  Frame* frame = take();
+  if (frame == NULL) {
+    return NULL;
+  }
+
+  if (frame->capacity < len) {
+    free(frame->storage);
+    frame->storage = frame_alloc(len);
+    if (frame->storage == NULL) {
+      frame->capacity = 0;
+      frame->refs = 0;
+      return NULL;
+    }
+    frame->capacity = len;
+  }
+
+  frame->buf = frame->storage;
+  frame->len = len;
+  frame->lender = NULL;
+  frame->handle = NULL;
+  return frame;
+}
+
+Frame* FramePool::hold(FrameSource& lender, const FrameView& view) {
+  Frame* frame = take();
+  if (frame == NULL) {
+    return NULL;
+  }
+
+  frame->buf = view.buf;
+  frame->len = view.len;
+  frame->lender = &lender;
+  frame->handle = view.handle;
+  return frame;
+}
+
+void FramePool::retain(Frame* frame) { frame->refs++; }
+
+void FramePool::release(Frame* frame) {
+  // read first, the frame may be taken again as soon as it is back in the pool
+  FrameSource* lender = frame->lender;
+  void* handle = frame->handle;
+
+  if (--frame->refs == 0 && lender != NULL) {
+    lender->recycle(handle);
+  }
+}
+
+int FramePool::in_use() {
+  int count = 0;
+  for (int i = 0; i < PIPELINE_POOL_FRAMES; i++) {
+    if (frames_[i].refs > 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+FrameQueue::FrameQueue(FramePool& pool, int capacity)
+    : pool_(pool), capacity_(capacity < PIPELINE_QUEUE_MAX ? capacity : PIPELINE_QUEUE_MAX), head_(0), count_(0),
+      closed_(false) {}
+
+bool FrameQueue::push(Frame* frame) {
+  Frame* dropped = NULL;
+
+  pool_.retain(frame);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+      dropped = frame;
+    } else {
+      if (count_ == capacity_) {
+        dropped = slots_[head_];
+        head_ = (head_ + 1) % capacity_;
+        count_--;
+      }
+      slots_[(head_ + count_) % capacity_] = frame;
+      count_++;
+    }
+  }
+  ready_.notify_one();
+
+  if (dropped != NULL) {
+    pool_.release(dropped);
+    return false;
+  }
+  return true;
+}
+
+Frame* FrameQueue::pop(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (!ready_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return count_ > 0 || closed_; })) {
+    return NULL;
+  }
+  if (count_ == 0) {
+    return NULL;
+  }
+
+  Frame* frame = slots_[head_];
+  head_ = (head_ + 1) % capacity_;
+  count_--;
+  lock.unlock();
+
+  drained_.notify_all();
+  return frame;
+}
+
+bool FrameQueue::wait_empty(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  return drained_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return count_ == 0 || closed_; })
+         && !closed_;
+}
+
+void FrameQueue::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (count_ > 0) {
+      pool_.release(slots_[head_]);
+      head_ = (head_ + 1) % capacity_;
+      count_--;
+    }
+    closed_ = true;
+  }
+  ready_.notify_all();
+  drained_.notify_all();
+}
+
+void FrameQueue::reopen() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = false;
+}
+
+FramePipeline::FramePipeline(FrameSource& source, FrameSink& decoder, FrameSink& streamer)
+    : source_(source), decoder_(decoder), streamer_(streamer), decode_queue_(pool_, DECODE_QUEUE_FRAMES),
+      stream_queue_(pool_, STREAM_QUEUE_FRAMES), static_frames_(0), change_decoded_(0), running_(false) {}
+
+FramePipeline::~FramePipeline() { stop(); }
+
+std::thread FramePipeline::spawn(const char* name, int core, size_t stack_size, void (FramePipeline::*task)()) {
+#ifdef ESP_PLATFORM
+  esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+  cfg.thread_name = name;
+  cfg.pin_to_core = core;
+  cfg.stack_size = stack_size;
+  esp_pthread_set_cfg(&cfg);
+#else
+  (void)name;
+  (void)core;
+  (void)stack_size;
+#endif
+
+  std::thread thread(task, this);
+
+#ifdef ESP_PLATFORM
+  cfg = esp_pthread_get_default_config();
+  esp_pthread_set_cfg(&cfg);
+#endif
+  return thread;
+}
+
+void FramePipeline::start() {
+  if (running_) {
+    return;
+  }
+
+  running_ = true;
+  decode_queue_.reopen();
+  stream_queue_.reopen();
+  decode_thread_ = spawn("decode", PIPELINE_DECODE_CORE, DECODE_STACK_SIZE, &FramePipeline::decode_task);
+  stream_thread_ = spawn("stream", PIPELINE_STREAM_CORE, STREAM_STACK_SIZE, &FramePipeline::stream_task);
+  capture_thread_ = spawn("capture", PIPELINE_CAPTURE_CORE, CAPTURE_STACK_SIZE, &FramePipeline::capture_task);
+}
+
+void FramePipeline::stop() {
+  if (!running_) {
+    return;
+  }
+
+  running_ = false;
+  capture_thread_.join();
+  decode_queue_.close();
+  stream_queue_.close();
+  decode_thread_.join();
+  stream_thread_.join();
+}
+
+void FramePipeline::watch_scene(const Frame* frame) {
+  const uint8_t* luma = frame->buf;
+  int width = frame->width;
+  int height = frame->height;
+
+  // only grayscale frames have a luma plane to compare, others may have a preview
+  if ((frame->len < (size_t)width * height && (luma = source_.preview(*frame, width, height)) == NULL)
+      || scene_.changed(luma, width, height)) {
+    static_frames_ = 0;
+    change_decoded_ = stats_.decoded;
+  } else if (static_frames_ < PIPELINE_STATIC_FRAMES) {
+    // stops counting once capture idles
+    static_frames_++;
+  }
+}
+
+void FramePipeline::capture_task() {
+  uint32_t seq = 0;
+
+  while (running_) {
+    bool viewer = streamer_.wants_frames();
+
+    // without a viewer there is no point in capturing faster than we decode
+    if (!viewer && !decode_queue_.wait_empty(IDLE_POLL_MS)) {
+      continue;
+    }
+
+    FrameView view;
+    if (!source_.grab(view)) {
+      stats_.capture_failed++;
+      continue;
+    }
+
+    // a lent buffer is held until the consumers are done, anything else is copied out
+    Frame* frame = view.handle != NULL ? pool_.hold(source_, view) : pool_.acquire(view.len);
+    if (frame == NULL) {
+      if (view.handle != NULL) {
+        source_.recycle(view.handle);
+      }
+      stats_.pool_exhausted++;
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (view.handle == NULL) {
+      memcpy(frame->buf, view.buf, view.len);
+    }
+    frame->width = view.width;
+    frame->height = view.height;
+    frame->format = view.format;
+    frame->seq = seq++;
+    stats_.captured++;
+
+    watch_scene(frame);
+    // counted in frames the decoder took, a viewer may have capture run much faster
+    bool decoding = stats_.decoded - change_decoded_ <= PIPELINE_DECODE_FRAMES;
+    bool idle = static_frames_ >= PIPELINE_STATIC_FRAMES && !decoding && !viewer;
+
+    if (!decoding) {
+      stats_.decode_skipped++;
+    } else if (!decode_queue_.push(frame)) {
+      stats_.decode_dropped++;
+    }
+    if (viewer && !stream_queue_.push(frame)) {
+      stats_.stream_dropped++;
+    }
+    pool_.release(frame);
+
+    stats_.idle = idle;
+    if (idle) {
+      stats_.idle_frames++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(PIPELINE_IDLE_PERIOD_MS));
+    }
+  }
+}
+
+void FramePipeline::consume_task(FrameQueue& queue, FrameSink& sink, std::atomic<uint32_t>& done) {
+  while (running_) {
+    Frame* frame = queue.pop(IDLE_POLL_MS);
+    if (frame == NULL) {
+      continue;
+    }
+
+    sink.consume(*frame);
+    pool_.release(frame);
+    done++;
+  }
+}
+
+void FramePipeline::decode_task() { consume_task(decode_queue_, decoder_, stats_.decoded); }
+
+void FramePipeline::stream_task() { consume_task(stream_queue_, streamer_, stats_.streamed); }
@@ -0,0 +1,238 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+
+#include "scene.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_camera.h"
+#endif
+
+/* Capture, decode and streaming run as separate tasks that hand frames to
+ * each other through bounded queues. A queue that is full drops its oldest
+ * frame, so a slow consumer always works on the most recent picture and
+ * never holds up the others.
+ *
+ * Capture runs whether or not anybody watches the stream. Without a viewer
+ * it only takes a picture when the decoder is ready for one, and once the
+ * scene has been static for a while it drops to an idle rate until
+ * something moves again.
+ *
+ * Only frames that show a change, and a few after each change, are handed
+ * to the decoder. A code that was in view before is already decoded, and
+ * one that arrives is given some frames to settle. The change may be
+ * looked for in a part of the frame only, where codes are decoded.
+ *
+ * The graph only needs std::thread, so it builds for the firmware and for
+ * the host. On the ESP32 the tasks are pinned to a core.
+ */
+
+// frames in flight: one being captured plus a queued and a busy one per consumer
+#define PIPELINE_POOL_FRAMES  5
+#define PIPELINE_QUEUE_MAX    4
+
+#define PIPELINE_CAPTURE_CORE 1
+#define PIPELINE_DECODE_CORE  0
+#define PIPELINE_STREAM_CORE  1
+
+// unchanged frames in a row before capture idles
+#define PIPELINE_STATIC_FRAMES  10
+// unchanged frames the decoder takes after a change before the others are skipped
+#define PIPELINE_DECODE_FRAMES  10
+#define PIPELINE_IDLE_PERIOD_MS 250
+
+class FrameSource;
+
+#ifdef ESP_PLATFORM
+#define FRAME_FORMAT_GRAYSCALE PIXFORMAT_GRAYSCALE
+#else
+// the host has no esp_camera.h, this is the value of PIXFORMAT_GRAYSCALE there
+#define FRAME_FORMAT_GRAYSCALE 3
+#endif
+
+struct Frame {
+  // the picture, in the pool's own buffer or in one lent by the source
+  uint8_t* buf;
+  size_t len;
+  int width;
+  int height;
+  // pixformat_t, FRAME_FORMAT_GRAYSCALE for synthetic frames
+  int format;
+  uint32_t seq;
+  std::atomic<int> refs;
+
+  // kept between uses, only grows when a larger picture is copied in
+  uint8_t* storage;
+  size_t capacity;
+  // given back to the lender with the last reference
+  FrameSource* lender;
+  void* handle;
+
+  Frame()
+      : buf(NULL), len(0), width(0), height(0), format(0), seq(0), refs(0), storage(NULL), capacity(0), lender(NULL),
+        handle(NULL) {}
+};
+
+/* A picture taken by the frame source. Without a handle the buffer is the
+ * source's own and only valid until the next grab(), so it is copied. With
+ * one the buffer is lent until the handle is given back to recycle().
+ */
+struct FrameView {
+  uint8_t* buf;
+  size_t len;
+  int width;
+  int height;
+  int format;
+  void* handle;
+};
+
+/* Fixed set of reference counted frames. A frame either holds a copy in a
+ * buffer of its own, or the buffer the source lent it, which goes back to
+ * the source when the last reference is released.
+ */
+class FramePool
+{
+public:
+  ~FramePool();
+
+  // returns a frame holding one reference, or NULL when all are in use
+  Frame* acquire(size_t len);
+  // same for a lent buffer, which stays with the caller on failure
+  Frame* hold(FrameSource& lender, const FrameView& view);
+  void retain(Frame* frame);
+  void release(Frame* frame);
+  int in_use();
+
+private:
+  Frame* take();
+
+  Frame frames_[PIPELINE_POOL_FRAMES];
+};
+
+/* Bounded FIFO that drops its oldest frame when full */
+class FrameQueue
+{
+public:
+  FrameQueue(FramePool& pool, int capacity);
+
+  // takes its own reference, returns false when a queued frame was dropped
+  bool push(Frame* frame);
+  // the caller owns the returned reference, NULL on timeout or after close()
+  Frame* pop(int timeout_ms);
+  // false on timeout or after close()
+  bool wait_empty(int timeout_ms);
+  void close();
+  void reopen();
+
+private:
+  FramePool& pool_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable drained_;
+  Frame* slots_[PIPELINE_QUEUE_MAX];
+  int capacity_;
+  int head_;
+  int count_;
+  bool closed_;
+};
+
+class FrameSource
+{
+public:
+  virtual ~FrameSource() {}
+
+  // blocks until the next picture is available, false if none could be taken
+  virtual bool grab(FrameView& view) = 0;
+
+  // gives back a buffer lent by grab(), from whichever task released it last
+  virtual void recycle(void* handle) { (void)handle; }
+
+  /* A small luma image of a frame that has no luma plane of its own, such
+   * as a JPEG, to look for changes in. Valid until the next call, NULL if
+   * there is none. Only called from the capture task.
+   */
+  virtual const uint8_t* preview(const Frame& frame, int& width, int& height) {
+    (void)frame;
+    (void)width;
+    (void)height;
+    return NULL;
+  }
+};
+
+class FrameSink
+{
+public:
+  virtual ~FrameSink() {}
+
+  // frames are only queued for a sink that wants them
+  virtual bool wants_frames() { return true; }
+
+  virtual void consume(const Frame& frame) = 0;
+};
+
+struct PipelineStats {
+  std::atomic<uint32_t> captured;
+  std::atomic<uint32_t> capture_failed;
+  std::atomic<uint32_t> pool_exhausted;
+  std::atomic<uint32_t> decoded;
+  std::atomic<uint32_t> decode_dropped;
+  // not decoded because nothing changed
+  std::atomic<uint32_t> decode_skipped;
+  std::atomic<uint32_t> streamed;
+  std::atomic<uint32_t> stream_dropped;
+  std::atomic<uint32_t> idle_frames;
+  std::atomic<bool> idle;
+
+  PipelineStats()
+      : captured(0), capture_failed(0), pool_exhausted(0), decoded(0), decode_dropped(0), decode_skipped(0),
+        streamed(0), stream_dropped(0), idle_frames(0), idle(false) {}
+};
+
+class FramePipeline
+{
+public:
+  FramePipeline(FrameSource& source, FrameSink& decoder, FrameSink& streamer);
+  ~FramePipeline();
+
+  void start();
+  // joins the tasks, every frame is back in the pool afterwards
+  void stop();
+
+  const PipelineStats& stats() const { return stats_; }
+
+  // where changes are looked for, in 1/SCENE_REGION_SCALE of the frame; call before start()
+  void set_scene_region(int left, int top, int width, int height) { scene_.set_region(left, top, width, height); }
+
+private:
+  std::thread spawn(const char* name, int core, size_t stack_size, void (FramePipeline::*task)());
+  void watch_scene(const Frame* frame);
+  void capture_task();
+  void consume_task(FrameQueue& queue, FrameSink& sink, std::atomic<uint32_t>& done);
+  void decode_task();
+  void stream_task();
+
+  FrameSource& source_;
+  FrameSink& decoder_;
+  FrameSink& streamer_;
+  FramePool pool_;
+  FrameQueue decode_queue_;
+  FrameQueue stream_queue_;
+  PipelineStats stats_;
+  SceneMonitor scene_;
+  // frames since the scene last changed
+  int static_frames_;
+  // stats_.decoded when the scene last changed
+  uint32_t change_decoded_;
+  std::atomic<bool> running_;
+  std::thread capture_thread_;
+  std::thread decode_thread_;
+  std::thread stream_thread_;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "scene.h"
+
+#include <stdlib.h>
+
+#define SCENE_SAMPLE_STEP 4
+
+void SceneMonitor::set_region(int left, int top, int width, int height) {
+  if (width <= 0 || height <= 0) {
+    left = top = 0;
+    width = height = SCENE_REGION_SCALE;
+  }
+
+  region_[0] = left;
+  region_[1] = top;
+  region_[2] = width;
+  region_[3] = height;
+  valid_ = false;
+}
+
+bool SceneMonitor::changed(const uint8_t* luma, int width, int height) {
+  int left = width * region_[0] / SCENE_REGION_SCALE;
+  int top = height * region_[1] / SCENE_REGION_SCALE;
+  int right = width * (region_[0] + region_[2]) / SCENE_REGION_SCALE;
+  int bottom = height * (region_[1] + region_[3]) / SCENE_REGION_SCALE;
+
+  if (left < 0) {
+    left = 0;
+  }
+  if (top < 0) {
+    top = 0;
+  }
+  if (right > width) {
+    right = width;
+  }
+  if (bottom > height) {
+    bottom = height;
+  }
+
+  int block_w = (right - left) / SCENE_GRID_W;
+  int block_h = (bottom - top) / SCENE_GRID_H;
+  // a signature of a frame of another size can't be compared
+  bool changed = !valid_ || width != width_ || height != height_;
+
+  if (block_w < 1 || block_h < 1) {
+    return true;
+  }
+
+  for (int by = 0; by < SCENE_GRID_H; by++) {
+    for (int bx = 0; bx < SCENE_GRID_W; bx++) {
+      int x0 = left + bx * block_w;
+      int y0 = top + by * block_h;
+      uint32_t sum = 0;
+      uint32_t count = 0;
+
+      for (int y = y0; y < y0 + block_h; y += SCENE_SAMPLE_STEP) {
+        const uint8_t* row = luma + y * width;
+        for (int x = x0; x < x0 + block_w; x += SCENE_SAMPLE_STEP) {
+          sum += row[x];
+          count++;
+        }
+      }
+
+      uint8_t mean = sum / count;
+      uint8_t* prev = &signature_[by * SCENE_GRID_W + bx];
+      if (abs(mean - *prev) > SCENE_BLOCK_THRESHOLD) {
+        changed = true;
+      }
+      *prev = mean;
+    }
+  }
+
+  valid_ = true;
+  width_ = width;
+  height_ = height;
+  return changed;
+}
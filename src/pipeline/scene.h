@@ -0,0 +1,39 @@
+#ifndef SCENE_H_
+#define SCENE_H_
+
+#include <stdint.h>
+
+#define SCENE_GRID_W          16
+#define SCENE_GRID_H          12
+// a block whose mean moves by more than this counts as changed
+#define SCENE_BLOCK_THRESHOLD 12
+// regions are given in 1/SCENE_REGION_SCALE of the frame
+#define SCENE_REGION_SCALE    10000
+
+/* Compares a coarse grid of block means against the previous frame. Only
+ * every fourth pixel of every fourth row is read, which is cheap enough
+ * to run on every captured frame. The grid covers the whole frame, or
+ * only the region that is watched.
+ */
+class SceneMonitor
+{
+public:
+  SceneMonitor() : valid_(false), width_(0), height_(0), region_{0, 0, SCENE_REGION_SCALE, SCENE_REGION_SCALE} {}
+
+  // true when the luma plane differs from the one seen before
+  bool changed(const uint8_t* luma, int width, int height);
+  void reset() { valid_ = false; }
+
+  // a zero width or height watches the whole frame again
+  void set_region(int left, int top, int width, int height);
+
+private:
+  uint8_t signature_[SCENE_GRID_W * SCENE_GRID_H];
+  bool valid_;
+  // frame size the signature was taken at
+  int width_;
+  int height_;
+  int region_[4];
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "seen_codes.h"
+
+uint32_t SeenCodes::hash(const uint8_t* payload, int len) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    hash ^= payload[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+int SeenCodes::find(uint32_t hash, int len) const {
+  for (int i = 0; i < SEEN_CODES_MAX; i++) {
+    const Entry* entry = &entries_[i];
+    if (entry->used && entry->hash == hash && entry->len == len) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void SeenCodes::begin_frame() {
+  for (int i = 0; i < SEEN_CODES_MAX; i++) {
+    in_frame_[i] = false;
+  }
+}
+
+bool SeenCodes::is_new(const uint8_t* payload, int len) const { return find(hash(payload, len), len) < 0; }
+
+void SeenCodes::mark(const uint8_t* payload, int len) {
+  uint32_t h = hash(payload, len);
+  int slot = find(h, len);
+
+  if (slot < 0) {
+    // takes a free slot, or the one missing for the longest time
+    for (int i = 0; i < SEEN_CODES_MAX; i++) {
+      if (!entries_[i].used) {
+        slot = i;
+        break;
+      }
+      if (!in_frame_[i] && (slot < 0 || entries_[i].misses > entries_[slot].misses)) {
+        slot = i;
+      }
+    }
+  }
+  if (slot < 0) {
+    // quirc reports no more codes per frame than there are entries
+    return;
+  }
+
+  Entry* entry = &entries_[slot];
+  entry->used = true;
+  entry->hash = h;
+  entry->len = len;
+  entry->misses = 0;
+  in_frame_[slot] = true;
+}
+
+void SeenCodes::end_frame(int decoded) {
+  if (decoded == 0) {
+    return;
+  }
+
+  for (int i = 0; i < SEEN_CODES_MAX; i++) {
+    Entry* entry = &entries_[i];
+    if (entry->used && !in_frame_[i] && ++entry->misses >= SEEN_CODES_FORGET_AFTER) {
+      entry->used = false;
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef SEEN_CODES_H_
+#define SEEN_CODES_H_
+
+#include <stdint.h>
+
+// several cubes can be in view at once, quirc reports at most 8 grids
+#define SEEN_CODES_MAX          8
+// frames with a decode in which a code may be missing before it is forgotten
+#define SEEN_CODES_FORGET_AFTER 5
+
+/* Codes that were published recently. A payload is published again only
+ * after it has been missing from SEEN_CODES_FORGET_AFTER frames that
+ * decoded something else, so a cube that flickers in and out of decode is
+ * reported once. Frames without any decoded code do not age the entries.
+ *
+ * For every frame: begin_frame(), then for each decoded payload publish
+ * it if is_new() and call mark() unless publishing failed, then
+ * end_frame() with the number of payloads decoded.
+ */
+class SeenCodes
+{
+public:
+  SeenCodes() : entries_{}, in_frame_{} {}
+
+  void begin_frame();
+
+  // true when the payload was not published recently
+  bool is_new(const uint8_t* payload, int len) const;
+
+  // notes the payload as in view, remembering it if it is new
+  void mark(const uint8_t* payload, int len);
+
+  // ages the codes that were not marked, if anything was decoded
+  void end_frame(int decoded);
+
+private:
+  struct Entry {
+    bool used;
+    uint32_t hash;
+    int len;
+    uint8_t misses;
+  };
+
+  static uint32_t hash(const uint8_t* payload, int len);
+  int find(uint32_t hash, int len) const;
+
+  Entry entries_[SEEN_CODES_MAX];
+  bool in_frame_[SEEN_CODES_MAX];
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "synthetic_source.h"
+
+#include <thread>
+
+// as long as the camera driver waits for a framebuffer
+#define LENT_WAIT_MS 4000
+
+SyntheticFrameSource::SyntheticFrameSource(int width, int height, int fps, int lent_buffers)
+    : width_(width), height_(height), period_(1000000 / (fps > 0 ? fps : 1)), next_(std::chrono::steady_clock::now()),
+      count_(0), moving_(true), image_(lent_buffers > 0 ? 0 : width * height) {
+  for (int i = 0; i < lent_buffers; i++) {
+    buffers_.push_back(std::vector<uint8_t>(width * height));
+    free_.push_back(i);
+  }
+}
+
+void SyntheticFrameSource::draw(uint8_t* image) {
+  int side = height_ / 4;
+  int left = (count_ * 4) % (width_ - side);
+  int top = (height_ - side) / 2;
+
+  for (int y = 0; y < height_; y++) {
+    uint8_t* row = &image[y * width_];
+    for (int x = 0; x < width_; x++) {
+      bool inside = x >= left && x < left + side && y >= top && y < top + side;
+      row[x] = inside ? 0 : (uint8_t)(64 + (x + y + count_) % 128);
+    }
+  }
+  if (moving_) {
+    count_++;
+  }
+}
+
+bool SyntheticFrameSource::grab(FrameView& view) {
+  std::this_thread::sleep_until(next_);
+  next_ += period_;
+
+  uint8_t* image = image_.data();
+  void* handle = NULL;
+
+  if (!buffers_.empty()) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!recycled_.wait_for(lock, std::chrono::milliseconds(LENT_WAIT_MS), [this] { return !free_.empty(); })) {
+      return false;
+    }
+
+    std::vector<uint8_t>& buffer = buffers_[free_.back()];
+    free_.pop_back();
+    image = buffer.data();
+    handle = &buffer;
+  }
+
+  draw(image);
+
+  view.buf = image;
+  view.len = (size_t)width_ * height_;
+  view.width = width_;
+  view.height = height_;
+  view.format = FRAME_FORMAT_GRAYSCALE;
+  view.handle = handle;
+  return true;
+}
+
+void SyntheticFrameSource::recycle(void* handle) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back((std::vector<uint8_t>*)handle - buffers_.data());
+  }
+  recycled_.notify_one();
+}
+
+int SyntheticFrameSource::lent() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return buffers_.size() - free_.size();
+}
@@ -0,0 +1,48 @@
+#ifndef SYNTHETIC_SOURCE_H_
+#define SYNTHETIC_SOURCE_H_
+
+#include "pipeline.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/* Grayscale frames of a square sliding across a gradient, paced like a
+ * camera, for running the pipeline without one.
+ *
+ * With buffers to lend, frames are drawn into a fixed set of them and lent
+ * out the way the camera driver lends its framebuffers. grab() then waits
+ * for one to be given back when all of them are held.
+ */
+class SyntheticFrameSource : public FrameSource
+{
+public:
+  SyntheticFrameSource(int width, int height, int fps, int lent_buffers = 0);
+
+  bool grab(FrameView& view) override;
+  void recycle(void* handle) override;
+  // a still scene lets the pipeline idle
+  void set_moving(bool moving) { moving_ = moving; }
+  // buffers not given back yet
+  int lent();
+
+private:
+  void draw(uint8_t* image);
+
+  int width_;
+  int height_;
+  std::chrono::microseconds period_;
+  std::chrono::steady_clock::time_point next_;
+  uint32_t count_;
+  std::atomic<bool> moving_;
+  std::vector<uint8_t> image_;
+  std::vector<std::vector<uint8_t> > buffers_;
+  // indices of the buffers that are not lent
+  std::vector<int> free_;
+  std::mutex mutex_;
+  std::condition_variable recycled_;
+};
+
+#endif
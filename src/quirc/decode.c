@@ -16,6 +16,7 @@
 
 #include "quirc_internal.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -73,6 +74,110 @@ static const uint8_t gf256_log[256] = {
 
 const static struct galois_field gf256 = {.p = 255, .log = gf256_log, .exp = gf256_exp};
 
+/* Field element with log e, for 0 <= e <= 2p. Both exp tables repeat
+ * their first entry at index p, and log[1] is p.
+ */
+static inline uint8_t gf_exp(const struct galois_field *gf, int e) { return gf->exp[e >= gf->p ? e - gf->p : e]; }
+
+static inline uint8_t gf_mul(const struct galois_field *gf, uint8_t a, uint8_t b) {
+  if (!a || !b)
+    return 0;
+
+  return gf_exp(gf, gf->log[a] + gf->log[b]);
+}
+
+static inline uint8_t gf_div(const struct galois_field *gf, uint8_t a, uint8_t b) {
+  if (!a || !b)
+    return 0;
+
+  return gf_exp(gf, gf->p - gf->log[b] + gf->log[a]);
+}
+
+/* Products with alpha^i in GF(2^8), split by nibble: alpha^i * v is
+ * tables[i][0][v & 0xf] ^ tables[i][1][v >> 4]. QR codes have at most
+ * 30 parity bytes per block, so these cover every syndrome.
+ *
+ * The tables are read from flash through the cache. Define
+ * QUIRC_RS_TABLE_ATTR as DRAM_ATTR to keep them in internal RAM.
+ */
+#define RS_MAX_SYNDROMES 30
+
+#ifndef QUIRC_RS_TABLE_ATTR
+#define QUIRC_RS_TABLE_ATTR
+#endif
+
+/* With SSSE3 the syndromes of up to 16 blocks are found at once, one
+ * block per byte lane, with each nibble table used as a shuffle. The
+ * ESP32 target uses the scalar loop.
+ */
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define RS_SSSE3
+#define RS_LANES 16
+#endif
+
+static const uint8_t gf256_syndrome_tables[RS_MAX_SYNDROMES][2][16] QUIRC_RS_TABLE_ATTR = {
+    {{0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f},
+     {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xa0, 0xb0, 0xc0, 0xd0, 0xe0, 0xf0}},
+    {{0x00, 0x02, 0x04, 0x06, 0x08, 0x0a, 0x0c, 0x0e, 0x10, 0x12, 0x14, 0x16, 0x18, 0x1a, 0x1c, 0x1e},
+     {0x00, 0x20, 0x40, 0x60, 0x80, 0xa0, 0xc0, 0xe0, 0x1d, 0x3d, 0x5d, 0x7d, 0x9d, 0xbd, 0xdd, 0xfd}},
+    {{0x00, 0x04, 0x08, 0x0c, 0x10, 0x14, 0x18, 0x1c, 0x20, 0x24, 0x28, 0x2c, 0x30, 0x34, 0x38, 0x3c},
+     {0x00, 0x40, 0x80, 0xc0, 0x1d, 0x5d, 0x9d, 0xdd, 0x3a, 0x7a, 0xba, 0xfa, 0x27, 0x67, 0xa7, 0xe7}},
+    {{0x00, 0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38, 0x40, 0x48, 0x50, 0x58, 0x60, 0x68, 0x70, 0x78},
+     {0x00, 0x80, 0x1d, 0x9d, 0x3a, 0xba, 0x27, 0xa7, 0x74, 0xf4, 0x69, 0xe9, 0x4e, 0xce, 0x53, 0xd3}},
+    {{0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xa0, 0xb0, 0xc0, 0xd0, 0xe0, 0xf0},
+     {0x00, 0x1d, 0x3a, 0x27, 0x74, 0x69, 0x4e, 0x53, 0xe8, 0xf5, 0xd2, 0xcf, 0x9c, 0x81, 0xa6, 0xbb}},
+    {{0x00, 0x20, 0x40, 0x60, 0x80, 0xa0, 0xc0, 0xe0, 0x1d, 0x3d, 0x5d, 0x7d, 0x9d, 0xbd, 0xdd, 0xfd},
+     {0x00, 0x3a, 0x74, 0x4e, 0xe8, 0xd2, 0x9c, 0xa6, 0xcd, 0xf7, 0xb9, 0x83, 0x25, 0x1f, 0x51, 0x6b}},
+    {{0x00, 0x40, 0x80, 0xc0, 0x1d, 0x5d, 0x9d, 0xdd, 0x3a, 0x7a, 0xba, 0xfa, 0x27, 0x67, 0xa7, 0xe7},
+     {0x00, 0x74, 0xe8, 0x9c, 0xcd, 0xb9, 0x25, 0x51, 0x87, 0xf3, 0x6f, 0x1b, 0x4a, 0x3e, 0xa2, 0xd6}},
+    {{0x00, 0x80, 0x1d, 0x9d, 0x3a, 0xba, 0x27, 0xa7, 0x74, 0xf4, 0x69, 0xe9, 0x4e, 0xce, 0x53, 0xd3},
+     {0x00, 0xe8, 0xcd, 0x25, 0x87, 0x6f, 0x4a, 0xa2, 0x13, 0xfb, 0xde, 0x36, 0x94, 0x7c, 0x59, 0xb1}},
+    {{0x00, 0x1d, 0x3a, 0x27, 0x74, 0x69, 0x4e, 0x53, 0xe8, 0xf5, 0xd2, 0xcf, 0x9c, 0x81, 0xa6, 0xbb},
+     {0x00, 0xcd, 0x87, 0x4a, 0x13, 0xde, 0x94, 0x59, 0x26, 0xeb, 0xa1, 0x6c, 0x35, 0xf8, 0xb2, 0x7f}},
+    {{0x00, 0x3a, 0x74, 0x4e, 0xe8, 0xd2, 0x9c, 0xa6, 0xcd, 0xf7, 0xb9, 0x83, 0x25, 0x1f, 0x51, 0x6b},
+     {0x00, 0x87, 0x13, 0x94, 0x26, 0xa1, 0x35, 0xb2, 0x4c, 0xcb, 0x5f, 0xd8, 0x6a, 0xed, 0x79, 0xfe}},
+    {{0x00, 0x74, 0xe8, 0x9c, 0xcd, 0xb9, 0x25, 0x51, 0x87, 0xf3, 0x6f, 0x1b, 0x4a, 0x3e, 0xa2, 0xd6},
+     {0x00, 0x13, 0x26, 0x35, 0x4c, 0x5f, 0x6a, 0x79, 0x98, 0x8b, 0xbe, 0xad, 0xd4, 0xc7, 0xf2, 0xe1}},
+    {{0x00, 0xe8, 0xcd, 0x25, 0x87, 0x6f, 0x4a, 0xa2, 0x13, 0xfb, 0xde, 0x36, 0x94, 0x7c, 0x59, 0xb1},
+     {0x00, 0x26, 0x4c, 0x6a, 0x98, 0xbe, 0xd4, 0xf2, 0x2d, 0x0b, 0x61, 0x47, 0xb5, 0x93, 0xf9, 0xdf}},
+    {{0x00, 0xcd, 0x87, 0x4a, 0x13, 0xde, 0x94, 0x59, 0x26, 0xeb, 0xa1, 0x6c, 0x35, 0xf8, 0xb2, 0x7f},
+     {0x00, 0x4c, 0x98, 0xd4, 0x2d, 0x61, 0xb5, 0xf9, 0x5a, 0x16, 0xc2, 0x8e, 0x77, 0x3b, 0xef, 0xa3}},
+    {{0x00, 0x87, 0x13, 0x94, 0x26, 0xa1, 0x35, 0xb2, 0x4c, 0xcb, 0x5f, 0xd8, 0x6a, 0xed, 0x79, 0xfe},
+     {0x00, 0x98, 0x2d, 0xb5, 0x5a, 0xc2, 0x77, 0xef, 0xb4, 0x2c, 0x99, 0x01, 0xee, 0x76, 0xc3, 0x5b}},
+    {{0x00, 0x13, 0x26, 0x35, 0x4c, 0x5f, 0x6a, 0x79, 0x98, 0x8b, 0xbe, 0xad, 0xd4, 0xc7, 0xf2, 0xe1},
+     {0x00, 0x2d, 0x5a, 0x77, 0xb4, 0x99, 0xee, 0xc3, 0x75, 0x58, 0x2f, 0x02, 0xc1, 0xec, 0x9b, 0xb6}},
+    {{0x00, 0x26, 0x4c, 0x6a, 0x98, 0xbe, 0xd4, 0xf2, 0x2d, 0x0b, 0x61, 0x47, 0xb5, 0x93, 0xf9, 0xdf},
+     {0x00, 0x5a, 0xb4, 0xee, 0x75, 0x2f, 0xc1, 0x9b, 0xea, 0xb0, 0x5e, 0x04, 0x9f, 0xc5, 0x2b, 0x71}},
+    {{0x00, 0x4c, 0x98, 0xd4, 0x2d, 0x61, 0xb5, 0xf9, 0x5a, 0x16, 0xc2, 0x8e, 0x77, 0x3b, 0xef, 0xa3},
+     {0x00, 0xb4, 0x75, 0xc1, 0xea, 0x5e, 0x9f, 0x2b, 0xc9, 0x7d, 0xbc, 0x08, 0x23, 0x97, 0x56, 0xe2}},
+    {{0x00, 0x98, 0x2d, 0xb5, 0x5a, 0xc2, 0x77, 0xef, 0xb4, 0x2c, 0x99, 0x01, 0xee, 0x76, 0xc3, 0x5b},
+     {0x00, 0x75, 0xea, 0x9f, 0xc9, 0xbc, 0x23, 0x56, 0x8f, 0xfa, 0x65, 0x10, 0x46, 0x33, 0xac, 0xd9}},
+    {{0x00, 0x2d, 0x5a, 0x77, 0xb4, 0x99, 0xee, 0xc3, 0x75, 0x58, 0x2f, 0x02, 0xc1, 0xec, 0x9b, 0xb6},
+     {0x00, 0xea, 0xc9, 0x23, 0x8f, 0x65, 0x46, 0xac, 0x03, 0xe9, 0xca, 0x20, 0x8c, 0x66, 0x45, 0xaf}},
+    {{0x00, 0x5a, 0xb4, 0xee, 0x75, 0x2f, 0xc1, 0x9b, 0xea, 0xb0, 0x5e, 0x04, 0x9f, 0xc5, 0x2b, 0x71},
+     {0x00, 0xc9, 0x8f, 0x46, 0x03, 0xca, 0x8c, 0x45, 0x06, 0xcf, 0x89, 0x40, 0x05, 0xcc, 0x8a, 0x43}},
+    {{0x00, 0xb4, 0x75, 0xc1, 0xea, 0x5e, 0x9f, 0x2b, 0xc9, 0x7d, 0xbc, 0x08, 0x23, 0x97, 0x56, 0xe2},
+     {0x00, 0x8f, 0x03, 0x8c, 0x06, 0x89, 0x05, 0x8a, 0x0c, 0x83, 0x0f, 0x80, 0x0a, 0x85, 0x09, 0x86}},
+    {{0x00, 0x75, 0xea, 0x9f, 0xc9, 0xbc, 0x23, 0x56, 0x8f, 0xfa, 0x65, 0x10, 0x46, 0x33, 0xac, 0xd9},
+     {0x00, 0x03, 0x06, 0x05, 0x0c, 0x0f, 0x0a, 0x09, 0x18, 0x1b, 0x1e, 0x1d, 0x14, 0x17, 0x12, 0x11}},
+    {{0x00, 0xea, 0xc9, 0x23, 0x8f, 0x65, 0x46, 0xac, 0x03, 0xe9, 0xca, 0x20, 0x8c, 0x66, 0x45, 0xaf},
+     {0x00, 0x06, 0x0c, 0x0a, 0x18, 0x1e, 0x14, 0x12, 0x30, 0x36, 0x3c, 0x3a, 0x28, 0x2e, 0x24, 0x22}},
+    {{0x00, 0xc9, 0x8f, 0x46, 0x03, 0xca, 0x8c, 0x45, 0x06, 0xcf, 0x89, 0x40, 0x05, 0xcc, 0x8a, 0x43},
+     {0x00, 0x0c, 0x18, 0x14, 0x30, 0x3c, 0x28, 0x24, 0x60, 0x6c, 0x78, 0x74, 0x50, 0x5c, 0x48, 0x44}},
+    {{0x00, 0x8f, 0x03, 0x8c, 0x06, 0x89, 0x05, 0x8a, 0x0c, 0x83, 0x0f, 0x80, 0x0a, 0x85, 0x09, 0x86},
+     {0x00, 0x18, 0x30, 0x28, 0x60, 0x78, 0x50, 0x48, 0xc0, 0xd8, 0xf0, 0xe8, 0xa0, 0xb8, 0x90, 0x88}},
+    {{0x00, 0x03, 0x06, 0x05, 0x0c, 0x0f, 0x0a, 0x09, 0x18, 0x1b, 0x1e, 0x1d, 0x14, 0x17, 0x12, 0x11},
+     {0x00, 0x30, 0x60, 0x50, 0xc0, 0xf0, 0xa0, 0x90, 0x9d, 0xad, 0xfd, 0xcd, 0x5d, 0x6d, 0x3d, 0x0d}},
+    {{0x00, 0x06, 0x0c, 0x0a, 0x18, 0x1e, 0x14, 0x12, 0x30, 0x36, 0x3c, 0x3a, 0x28, 0x2e, 0x24, 0x22},
+     {0x00, 0x60, 0xc0, 0xa0, 0x9d, 0xfd, 0x5d, 0x3d, 0x27, 0x47, 0xe7, 0x87, 0xba, 0xda, 0x7a, 0x1a}},
+    {{0x00, 0x0c, 0x18, 0x14, 0x30, 0x3c, 0x28, 0x24, 0x60, 0x6c, 0x78, 0x74, 0x50, 0x5c, 0x48, 0x44},
+     {0x00, 0xc0, 0x9d, 0x5d, 0x27, 0xe7, 0xba, 0x7a, 0x4e, 0x8e, 0xd3, 0x13, 0x69, 0xa9, 0xf4, 0x34}},
+    {{0x00, 0x18, 0x30, 0x28, 0x60, 0x78, 0x50, 0x48, 0xc0, 0xd8, 0xf0, 0xe8, 0xa0, 0xb8, 0x90, 0x88},
+     {0x00, 0x9d, 0x27, 0xba, 0x4e, 0xd3, 0x69, 0xf4, 0x9c, 0x01, 0xbb, 0x26, 0xd2, 0x4f, 0xf5, 0x68}},
+    {{0x00, 0x30, 0x60, 0x50, 0xc0, 0xf0, 0xa0, 0x90, 0x9d, 0xad, 0xfd, 0xcd, 0x5d, 0x6d, 0x3d, 0x0d},
+     {0x00, 0x27, 0x4e, 0x69, 0x9c, 0xbb, 0xd2, 0xf5, 0x25, 0x02, 0x6b, 0x4c, 0xb9, 0x9e, 0xf7, 0xd0}}};
+
 /************************************************************************
  * Polynomial operations
  */
@@ -93,14 +198,15 @@ static void poly_add(uint8_t *dst, const uint8_t *src, uint8_t c, int shift, con
     if (!v)
       continue;
 
-    dst[p] ^= gf->exp[(gf->log[v] + log_c) % gf->p];
+    dst[p] ^= gf_exp(gf, gf->log[v] + log_c);
   }
 }
 
 static uint8_t poly_eval(const uint8_t *s, uint8_t x, const struct galois_field *gf) {
   int i;
   uint8_t sum = 0;
-  uint8_t log_x = gf->log[x];
+  int log_x = gf->log[x];
+  int log_xi = 0; /* Log of x^i */
 
   if (!x)
     return s[0];
@@ -108,10 +214,12 @@ static uint8_t poly_eval(const uint8_t *s, uint8_t x, const struct galois_field
   for (i = 0; i < MAX_POLY; i++) {
     uint8_t c = s[i];
 
-    if (!c)
-      continue;
+    if (c)
+      sum ^= gf_exp(gf, gf->log[c] + log_xi);
 
-    sum ^= gf->exp[(gf->log[c] + log_x * i) % gf->p];
+    log_xi += log_x;
+    if (log_xi >= gf->p)
+      log_xi -= gf->p;
   }
 
   return sum;
@@ -121,7 +229,10 @@ static uint8_t poly_eval(const uint8_t *s, uint8_t x, const struct galois_field
  * Berlekamp-Massey algorithm for finding error locator polynomials.
  */
 
-static void berlekamp_massey(const uint8_t *s, int N, const struct galois_field *gf, uint8_t *sigma) {
+/* Returns the degree of the error locator, the number of errors it
+ * describes.
+ */
+static int berlekamp_massey(const uint8_t *s, int N, const struct galois_field *gf, uint8_t *sigma) {
   uint8_t C[MAX_POLY];
   uint8_t B[MAX_POLY];
   int L = 0;
@@ -139,14 +250,10 @@ static void berlekamp_massey(const uint8_t *s, int N, const struct galois_field
     uint8_t mult;
     int i;
 
-    for (i = 1; i <= L; i++) {
-      if (!(C[i] && s[n - i]))
-        continue;
+    for (i = 1; i <= L; i++)
+      d ^= gf_mul(gf, C[i], s[n - i]);
 
-      d ^= gf->exp[(gf->log[C[i]] + gf->log[s[n - i]]) % gf->p];
-    }
-
-    mult = gf->exp[(gf->p - gf->log[b] + gf->log[d]) % gf->p];
+    mult = gf_div(gf, d, b);
 
     if (!d) {
       m++;
@@ -166,6 +273,7 @@ static void berlekamp_massey(const uint8_t *s, int N, const struct galois_field
   }
 
   memcpy(sigma, C, MAX_POLY);
+  return L;
 }
 
 /************************************************************************
@@ -174,30 +282,97 @@ static void berlekamp_massey(const uint8_t *s, int N, const struct galois_field
  * Generator polynomial for GF(2^8) is x^8 + x^4 + x^3 + x^2 + 1
  */
 
+/* Syndrome i is the block evaluated at alpha^i. All of them are found
+ * in one pass over the block in Horner form, s = s * alpha^i + c, with
+ * the multiplication done by table lookups.
+ */
 static int block_syndromes(const uint8_t *data, int bs, int npar, uint8_t *s) {
-  int nonzero = 0;
-  int i;
+  uint8_t nonzero = 0;
+  int i, j;
 
   memset(s, 0, MAX_POLY);
 
-  for (i = 0; i < npar; i++) {
-    int j;
-
-    for (j = 0; j < bs; j++) {
-      uint8_t c = data[bs - j - 1];
+  for (j = 0; j < bs; j++) {
+    const uint8_t c = data[j];
 
-      if (!c)
-        continue;
+    for (i = 0; i < npar; i++) {
+      const uint8_t(*t)[16] = gf256_syndrome_tables[i];
 
-      s[i] ^= gf256_exp[((int)gf256_log[c] + i * j) % 255];
+      s[i] = t[0][s[i] & 0xf] ^ t[1][s[i] >> 4] ^ c;
     }
+  }
 
-    if (s[i])
-      nonzero = 1;
+  for (i = 0; i < npar; i++)
+    nonzero |= s[i];
+
+  return nonzero != 0;
+}
+
+#ifdef RS_SSSE3
+static __m128i lane_row(const uint8_t *row, int n) {
+  uint8_t buf[RS_LANES] = {0};
+
+  if (n == RS_LANES)
+    return _mm_loadu_si128((const __m128i *)row);
+
+  memcpy(buf, row, n);
+  return _mm_loadu_si128((const __m128i *)buf);
+}
+
+/* One Horner step of every syndrome, with one codeword per lane */
+static void lane_step(__m128i *acc, int npar, __m128i c) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  int i;
+
+  for (i = 0; i < npar; i++) {
+    const __m128i lo = _mm_loadu_si128((const __m128i *)gf256_syndrome_tables[i][0]);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)gf256_syndrome_tables[i][1]);
+    const __m128i s = acc[i];
+    const __m128i ls = _mm_shuffle_epi8(lo, _mm_and_si128(s, nibble));
+    const __m128i hs = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(s, 4), nibble));
+
+    acc[i] = _mm_xor_si128(_mm_xor_si128(ls, hs), c);
   }
+}
 
-  return nonzero;
+/* Syndromes of blocks first to first + 15 of the code stream, read
+ * straight from the interleaved codewords in the order codestream_ecc()
+ * gathers them. Syndrome i of block first + b is left in s[i][b].
+ */
+static void lane_syndromes(const uint8_t *raw, const struct quirc_rs_params *sb_ecc, int bc, int first,
+                           uint8_t s[RS_MAX_SYNDROMES][RS_LANES]) {
+  const int lb_count = bc - sb_ecc->ns;
+  const int ecc_offset = sb_ecc->dw * bc + lb_count;
+  const int npar = sb_ecc->bs - sb_ecc->dw;
+  const int n = bc - first < RS_LANES ? bc - first : RS_LANES;
+  __m128i acc[RS_MAX_SYNDROMES];
+  int i, j;
+
+  for (i = 0; i < npar; i++)
+    acc[i] = _mm_setzero_si128();
+
+  for (j = 0; j < sb_ecc->dw; j++)
+    lane_step(acc, npar, lane_row(raw + j * bc + first, n));
+
+  /* Only the large blocks have a data codeword here */
+  if (first + n > sb_ecc->ns) {
+    const __m128i large = _mm_cmpgt_epi8(_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+                                         _mm_set1_epi8((char)(sb_ecc->ns - first - 1)));
+    __m128i prev[RS_MAX_SYNDROMES];
+
+    memcpy(prev, acc, npar * sizeof(acc[0]));
+    lane_step(acc, npar, lane_row(raw + sb_ecc->dw * bc + first, n));
+    for (i = 0; i < npar; i++)
+      acc[i] = _mm_or_si128(_mm_and_si128(large, acc[i]), _mm_andnot_si128(large, prev[i]));
+  }
+
+  for (j = 0; j < npar; j++)
+    lane_step(acc, npar, lane_row(raw + ecc_offset + j * bc + first, n));
+
+  for (i = 0; i < npar; i++)
+    _mm_storeu_si128((__m128i *)s[i], acc[i]);
 }
+#endif
 
 static void eloc_poly(uint8_t *omega, const uint8_t *s, const uint8_t *sigma, int npar) {
   int i;
@@ -206,7 +381,7 @@ static void eloc_poly(uint8_t *omega, const uint8_t *s, const uint8_t *sigma, in
 
   for (i = 0; i < npar; i++) {
     const uint8_t a = sigma[i];
-    const uint8_t log_a = gf256_log[a];
+    const int log_a = gf256_log[a];
     int j;
 
     if (!a)
@@ -221,24 +396,23 @@ static void eloc_poly(uint8_t *omega, const uint8_t *s, const uint8_t *sigma, in
       if (!b)
         continue;
 
-      omega[i + j] ^= gf256_exp[(log_a + gf256_log[b]) % 255];
+      omega[i + j] ^= gf_exp(&gf256, log_a + gf256_log[b]);
     }
   }
 }
 
-static quirc_decode_error_t correct_block(uint8_t *data, const struct quirc_rs_params *ecc) {
+/* Corrects a block whose syndromes s are not all zero */
+static quirc_decode_error_t correct_block(uint8_t *data, const struct quirc_rs_params *ecc, const uint8_t *s) {
   int npar = ecc->bs - ecc->dw;
-  uint8_t s[MAX_POLY];
+  uint8_t check[MAX_POLY];
   uint8_t sigma[MAX_POLY];
   uint8_t sigma_deriv[MAX_POLY];
   uint8_t omega[MAX_POLY];
-  int i;
-
-  /* Compute syndrome vector */
-  if (!block_syndromes(data, ecc->bs, npar, s))
-    return QUIRC_SUCCESS;
+  int term[MAX_POLY];
+  int errors, found = 0;
+  int i, k;
 
-  berlekamp_massey(s, npar, &gf256, sigma);
+  errors = berlekamp_massey(s, npar, &gf256, sigma);
 
   /* Compute derivative of sigma */
   memset(sigma_deriv, 0, MAX_POLY);
@@ -248,20 +422,41 @@ static quirc_decode_error_t correct_block(uint8_t *data, const struct quirc_rs_p
   /* Compute error evaluator polynomial */
   eloc_poly(omega, s, sigma, npar - 1);
 
-  /* Find error locations and magnitudes */
-  for (i = 0; i < ecc->bs; i++) {
-    uint8_t xinv = gf256_exp[255 - i];
+  /* Find error locations with a Chien search. Term k of sigma at
+   * alpha^-i is stepped from its value at alpha^-(i-1) by adding -k to
+   * its log, and the search stops once every error has been located.
+   */
+  for (k = 0; k <= errors; k++)
+    term[k] = sigma[k] ? gf256_log[sigma[k]] : -1;
+
+  for (i = 0; i < ecc->bs && found < errors; i++) {
+    uint8_t sum = 0;
+
+    for (k = 0; k <= errors; k++) {
+      if (term[k] < 0)
+        continue;
+
+      sum ^= gf256_exp[term[k]];
+      term[k] += 255 - k;
+      if (term[k] >= 255)
+        term[k] -= 255;
+    }
 
-    if (!poly_eval(sigma, xinv, &gf256)) {
+    /* Forney's formula gives the magnitude of the error */
+    if (!sum) {
+      uint8_t xinv = gf256_exp[255 - i];
       uint8_t sd_x = poly_eval(sigma_deriv, xinv, &gf256);
       uint8_t omega_x = poly_eval(omega, xinv, &gf256);
-      uint8_t error = gf256_exp[(255 - gf256_log[sd_x] + gf256_log[omega_x]) % 255];
 
-      data[ecc->bs - i - 1] ^= error;
+      data[ecc->bs - i - 1] ^= gf_div(&gf256, omega_x, sd_x);
+      found++;
     }
   }
 
-  if (block_syndromes(data, ecc->bs, npar, s))
+  if (found != errors)
+    return QUIRC_ERROR_DATA_ECC;
+
+  if (block_syndromes(data, ecc->bs, npar, check))
     return QUIRC_ERROR_DATA_ECC;
 
   return QUIRC_SUCCESS;
@@ -298,12 +493,29 @@ static int format_syndromes(uint16_t u, uint8_t *s) {
   return nonzero;
 }
 
+/* The 32 format codewords, before masking */
+static const uint16_t format_codewords[32] = {
+    0x0000, 0x0537, 0x0a6e, 0x0f59, 0x11eb, 0x14dc, 0x1b85, 0x1eb2, 0x23d6, 0x26e1, 0x29b8,
+    0x2c8f, 0x323d, 0x370a, 0x3853, 0x3d64, 0x429b, 0x47ac, 0x48f5, 0x4dc2, 0x5370, 0x5647,
+    0x591e, 0x5c29, 0x614d, 0x647a, 0x6b23, 0x6e14, 0x70a6, 0x7591, 0x7ac8, 0x7fff};
+
 static quirc_decode_error_t correct_format(uint16_t *f_ret) {
   uint16_t u = *f_ret;
   int i;
   uint8_t s[MAX_POLY];
   uint8_t sigma[MAX_POLY];
 
+  /* The codewords are at least seven bits apart, so a word within three
+   * bits of one is corrected to it. That is the usual case and needs no
+   * syndromes. Words further off are left to the full decoder.
+   */
+  for (i = 0; i < 32; i++) {
+    if (__builtin_popcount(u ^ format_codewords[i]) <= 3) {
+      *f_ret = format_codewords[i];
+      return QUIRC_SUCCESS;
+    }
+  }
+
   /* Evaluate U (received codeword) at each of alpha_1 .. alpha_6
    * to get S_1 .. S_6 (but we index them from 0).
    */
@@ -329,12 +541,12 @@ static quirc_decode_error_t correct_format(uint16_t *f_ret) {
  */
 
 struct datastream {
-  uint8_t raw[QUIRC_MAX_PAYLOAD];
+  uint8_t *raw;
   int data_bits;
   int ptr;
 
-  uint8_t data[QUIRC_MAX_PAYLOAD];
-} __attribute__((aligned(8)));
+  uint8_t *data;
+};
 
 static inline int grid_bit(const struct quirc_code *code, int x, int y) {
   int p = y * code->size + x;
@@ -342,28 +554,57 @@ static inline int grid_bit(const struct quirc_code *code, int x, int y) {
   return (code->cell_bitmap[p >> 3] >> (p & 7)) & 1;
 }
 
-static quirc_decode_error_t read_format(const struct quirc_code *code, struct quirc_data *data, int which) {
+/* Cell of bit i of a copy of the format information, counting from the
+ * most significant bit. Copy 0 surrounds the top left finder, copy 1 is
+ * split between the other two.
+ */
+void quirc_format_cell(int size, int which, int i, int *x, int *y) {
+  static const int xs[QUIRC_FORMAT_BITS] = {0, 1, 2, 3, 4, 5, 7, 8, 8, 8, 8, 8, 8, 8, 8};
+  static const int ys[QUIRC_FORMAT_BITS] = {8, 8, 8, 8, 8, 8, 8, 8, 7, 5, 4, 3, 2, 1, 0};
+
+  if (!which) {
+    *x = xs[i];
+    *y = ys[i];
+  } else if (i < 7) {
+    *x = 8;
+    *y = size - 1 - i;
+  } else {
+    *x = size - 15 + i;
+    *y = 8;
+  }
+}
+
+static quirc_decode_error_t read_format_bits(const struct quirc_code *code, int which, uint16_t *format) {
   int i;
-  uint16_t format = 0;
-  uint16_t fdata;
-  quirc_decode_error_t err;
 
-  if (which) {
-    for (i = 0; i < 7; i++)
-      format = (format << 1) | grid_bit(code, 8, code->size - 1 - i);
-    for (i = 0; i < 8; i++)
-      format = (format << 1) | grid_bit(code, code->size - 8 + i, 8);
-  } else {
-    static const int xs[15] = {8, 8, 8, 8, 8, 8, 8, 8, 7, 5, 4, 3, 2, 1, 0};
-    static const int ys[15] = {0, 1, 2, 3, 4, 5, 7, 8, 8, 8, 8, 8, 8, 8, 8};
+  *format = 0;
+  for (i = 0; i < QUIRC_FORMAT_BITS; i++) {
+    int x, y;
 
-    for (i = 14; i >= 0; i--)
-      format = (format << 1) | grid_bit(code, xs[i], ys[i]);
+    quirc_format_cell(code->size, which, i, &x, &y);
+    *format = (*format << 1) | grid_bit(code, x, y);
   }
 
-  format ^= 0x5412;
+  *format ^= 0x5412;
+
+  return correct_format(format);
+}
+
+int quirc_check_format(const struct quirc_code *code) {
+  uint16_t format;
+
+  if (read_format_bits(code, 0, &format) && read_format_bits(code, 1, &format))
+    return -1;
 
-  err = correct_format(&format);
+  return 0;
+}
+
+static quirc_decode_error_t read_format(const struct quirc_code *code, struct quirc_data *data, int which) {
+  uint16_t format;
+  uint16_t fdata;
+  quirc_decode_error_t err;
+
+  err = read_format_bits(code, which, &format);
   if (err)
     return err;
 
@@ -466,23 +707,27 @@ static void read_bit(const struct quirc_code *code, struct quirc_data *data, str
   ds->data_bits++;
 }
 
-static void read_data(const struct quirc_code *code, struct quirc_data *data, struct datastream *ds) {
-  int y = code->size - 1;
-  int x = code->size - 1;
+/* Calls func for every data module of a grid, in the order its bits are
+ * read, with the module's row and column.
+ */
+static void walk_data(int version, void (*func)(void *user_data, int i, int j), void *user_data) {
+  int size = version * 4 + 17;
+  int y = size - 1;
+  int x = size - 1;
   int dir = -1;
 
   while (x > 0) {
     if (x == 6)
       x--;
 
-    if (!reserved_cell(data->version, y, x))
-      read_bit(code, data, ds, y, x);
+    if (!reserved_cell(version, y, x))
+      func(user_data, y, x);
 
-    if (!reserved_cell(data->version, y, x - 1))
-      read_bit(code, data, ds, y, x - 1);
+    if (!reserved_cell(version, y, x - 1))
+      func(user_data, y, x - 1);
 
     y += dir;
-    if (y < 0 || y >= code->size) {
+    if (y < 0 || y >= size) {
       dir = -dir;
       x -= 2;
       y += dir;
@@ -490,6 +735,129 @@ static void read_data(const struct quirc_code *code, struct quirc_data *data, st
   }
 }
 
+/* Data modules of one version in reading order, as bit indices into
+ * cell_bitmap, followed by the value of each mask pattern at them,
+ * packed most significant bit first like the codewords they are XORed
+ * into.
+ */
+struct data_map {
+  int count;
+  int mask_bytes;
+  uint16_t *cells;
+  uint8_t *masks; /* 8 planes of mask_bytes */
+};
+
+/* Built on first use and kept for the lifetime of the program. Decoders
+ * on other threads may race to build one, in which case the loser frees
+ * its copy.
+ */
+static struct data_map *data_maps[QUIRC_DATA_MAP_MAX_VERSION + 1];
+
+struct data_map_fill {
+  struct data_map *map;
+  int size;
+};
+
+static void count_cell(void *user_data, int i, int j) {
+  (void)i;
+  (void)j;
+  ((struct data_map *)user_data)->count++;
+}
+
+static void map_cell(void *user_data, int i, int j) {
+  struct data_map_fill *fill = (struct data_map_fill *)user_data;
+  struct data_map *map = fill->map;
+  int k = map->count++;
+  int m;
+
+  map->cells[k] = i * fill->size + j;
+  for (m = 0; m < 8; m++)
+    if (mask_bit(m, i, j))
+      map->masks[m * map->mask_bytes + (k >> 3)] |= 0x80 >> (k & 7);
+}
+
+static const struct data_map *data_map_get(int version) {
+  struct data_map *map;
+  struct data_map *expected = NULL;
+  struct data_map_fill fill;
+  struct data_map counted;
+
+  if (version > QUIRC_DATA_MAP_MAX_VERSION)
+    return NULL;
+
+  map = __atomic_load_n(&data_maps[version], __ATOMIC_ACQUIRE);
+  if (map)
+    return map;
+
+  counted.count = 0;
+  walk_data(version, count_cell, &counted);
+
+  map = ps_malloc(sizeof(*map) + counted.count * sizeof(uint16_t) + 8 * ((counted.count + 7) >> 3));
+  if (!map)
+    return NULL;
+
+  map->count = 0;
+  map->mask_bytes = (counted.count + 7) >> 3;
+  map->cells = (uint16_t *)(map + 1);
+  map->masks = (uint8_t *)(map->cells + counted.count);
+  memset(map->masks, 0, 8 * map->mask_bytes);
+
+  fill.map = map;
+  fill.size = version * 4 + 17;
+  walk_data(version, map_cell, &fill);
+
+  if (!__atomic_compare_exchange_n(&data_maps[version], &expected, map, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free(map);
+    return expected;
+  }
+
+  return map;
+}
+
+struct read_bits {
+  const struct quirc_code *code;
+  struct quirc_data *data;
+  struct datastream *ds;
+};
+
+static void read_cell_bit(void *user_data, int i, int j) {
+  struct read_bits *rb = (struct read_bits *)user_data;
+
+  read_bit(rb->code, rb->data, rb->ds, i, j);
+}
+
+static void read_data(const struct quirc_code *code, struct quirc_data *data, struct datastream *ds) {
+  const struct data_map *map = data_map_get(data->version);
+  const uint8_t *mask;
+  int k;
+
+  if (!map) {
+    struct read_bits rb = {code, data, ds};
+
+    walk_data(data->version, read_cell_bit, &rb);
+    return;
+  }
+
+  /* Gather eight modules at a time and unmask them with one XOR */
+  mask = map->masks + data->mask * map->mask_bytes;
+  for (k = 0; k < map->count; k += 8) {
+    const uint16_t *cells = map->cells + k;
+    int n = map->count - k < 8 ? map->count - k : 8;
+    uint8_t byte = 0;
+    int b;
+
+    for (b = 0; b < n; b++) {
+      int p = cells[b];
+
+      byte |= ((code->cell_bitmap[p >> 3] >> (p & 7)) & 1) << (7 - b);
+    }
+
+    ds->raw[k >> 3] = byte ^ mask[k >> 3];
+  }
+
+  ds->data_bits = map->count;
+}
+
 static quirc_decode_error_t codestream_ecc(struct quirc_data *data, struct datastream *ds) {
   const struct quirc_version_info *ver = &quirc_version_db[data->version];
   const struct quirc_rs_params *sb_ecc = &ver->ecc[data->ecc_level];
@@ -499,6 +867,12 @@ static quirc_decode_error_t codestream_ecc(struct quirc_data *data, struct datas
   const int ecc_offset = sb_ecc->dw * bc + lb_count;
   int dst_offset = 0;
   int i;
+#ifdef RS_SSSE3
+  uint8_t lanes[RS_MAX_SYNDROMES][RS_LANES];
+#endif
+
+  if (sb_ecc->bs - sb_ecc->dw > RS_MAX_SYNDROMES)
+    return QUIRC_ERROR_DATA_ECC;
 
   memcpy(&lb_ecc, sb_ecc, sizeof(lb_ecc));
   lb_ecc.dw++;
@@ -508,7 +882,8 @@ static quirc_decode_error_t codestream_ecc(struct quirc_data *data, struct datas
     uint8_t *dst = ds->data + dst_offset;
     const struct quirc_rs_params *ecc = (i < sb_ecc->ns) ? sb_ecc : &lb_ecc;
     const int num_ec = ecc->bs - ecc->dw;
-    quirc_decode_error_t err;
+    uint8_t s[MAX_POLY];
+    int nonzero;
     int j;
 
     for (j = 0; j < ecc->dw; j++)
@@ -516,9 +891,24 @@ static quirc_decode_error_t codestream_ecc(struct quirc_data *data, struct datas
     for (j = 0; j < num_ec; j++)
       dst[ecc->dw + j] = ds->raw[ecc_offset + j * bc + i];
 
-    err = correct_block(dst, ecc);
-    if (err)
-      return err;
+#ifdef RS_SSSE3
+    if (!(i % RS_LANES))
+      lane_syndromes(ds->raw, sb_ecc, bc, i, lanes);
+
+    memset(s, 0, MAX_POLY);
+    nonzero = 0;
+    for (j = 0; j < num_ec; j++)
+      nonzero |= s[j] = lanes[j][i % RS_LANES];
+#else
+    nonzero = block_syndromes(dst, ecc->bs, num_ec, s);
+#endif
+
+    if (nonzero) {
+      quirc_decode_error_t err = correct_block(dst, ecc, s);
+
+      if (err)
+        return err;
+    }
 
     dst_offset += ecc->dw;
   }
@@ -774,47 +1164,64 @@ done:
   return QUIRC_SUCCESS;
 }
 
-quirc_decode_error_t quirc_decode(const struct quirc_code *code, struct quirc_data *data) {
+quirc_decode_error_t quirc_decode_with_scratch(const struct quirc_code *code, struct quirc_data *data,
+                                               struct quirc_decode_scratch *scratch) {
   quirc_decode_error_t err;
-  struct datastream *ds = ps_malloc(sizeof(struct datastream));
+  struct datastream ds = {.raw = scratch->raw, .data = scratch->data};
+  uint32_t start;
 
-  if ((code->size - 17) % 4) {
-    free(ds);
-    return QUIRC_ERROR_INVALID_GRID_SIZE;
-  }
+  /* The payload is filled in from the start and nul terminated, so
+   * only the fields before it need clearing.
+   */
+  memset(data, 0, offsetof(struct quirc_data, payload));
+  data->payload[0] = 0;
+  data->payload_len = 0;
+  data->eci = 0;
+  scratch->ecc_ticks = 0;
 
-  memset(data, 0, sizeof(*data));
-  memset(ds, 0, sizeof(*ds));
+  if ((code->size - 17) % 4)
+    return QUIRC_ERROR_INVALID_GRID_SIZE;
 
   data->version = (code->size - 17) / 4;
 
-  if (data->version < 1 || data->version > QUIRC_MAX_VERSION) {
-    free(ds);
+  if (data->version < 1 || data->version > QUIRC_MAX_VERSION)
     return QUIRC_ERROR_INVALID_VERSION;
-  }
 
   /* Read format information -- try both locations */
   err = read_format(code, data, 0);
   if (err)
     err = read_format(code, data, 1);
-  if (err) {
-    free(ds);
+  if (err)
     return err;
-  }
 
-  read_data(code, data, ds);
-  err = codestream_ecc(data, ds);
-  if (err) {
-    free(ds);
-    return err;
-  }
+  /* Modules are ORed into the raw codewords, which covers every
+   * codeword of this version and the remainder bits after them.
+   */
+  memset(ds.raw, 0, quirc_version_db[data->version].data_bytes + 1);
 
-  err = decode_payload(data, ds);
-  if (err) {
-    free(ds);
+  read_data(code, data, &ds);
+
+  start = scratch->clock ? scratch->clock() : 0;
+  err = codestream_ecc(data, &ds);
+  if (scratch->clock)
+    scratch->ecc_ticks = scratch->clock() - start;
+  if (err)
     return err;
+
+  return decode_payload(data, &ds);
+}
+
+quirc_decode_error_t quirc_decode(const struct quirc_code *code, struct quirc_data *data) {
+  quirc_decode_error_t err;
+  struct quirc_decode_scratch *scratch = ps_malloc(sizeof(*scratch));
+
+  if (!scratch) {
+    memset(data, 0, sizeof(*data));
+    return QUIRC_ERROR_OUT_OF_MEMORY;
   }
 
-  free(ds);
-  return QUIRC_SUCCESS;
+  scratch->clock = NULL;
+  err = quirc_decode_with_scratch(code, data, scratch);
+  free(scratch);
+  return err;
 }
\ No newline at end of file
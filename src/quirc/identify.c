@@ -16,10 +16,11 @@
 
 #include <limits.h>
 #include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "openmv/collections.h"
 #include "openmv/fmath.h"
 #include "quirc_internal.h"
 
@@ -101,25 +102,98 @@ static void perspective_unmap(const float *c, const struct quirc_point *in, floa
   *v = (c[0] * (y - c[5]) - c[2] * c[6] * y + (c[5] * c[6] - c[3]) * x + c[2] * c[3]) / den;
 }
 
+#if QUIRC_STEPPED_PERSPECTIVE
+/* Maps points (u + t * du, v) for t = 0, 1, 2... The numerators and the
+ * denominator are linear in t, and the reciprocal of the denominator is
+ * refined from the previous point's with two Newton steps, so only the
+ * first point needs a divide. Points land on the same pixel as
+ * perspective_map() except for a few in 10^4 that sit on a pixel edge.
+ */
+struct perspective_walk
+{
+  float x, y, den; /* At t = 0 */
+  float dx, dy, dden;
+  float inv; /* 1 / den at the previous point */
+  float t;
+#if QUIRC_PERSPECTIVE_CHECK
+  const float *c;
+  float u, v, du;
+#endif
+};
+
+#if QUIRC_PERSPECTIVE_CHECK
+static long check_samples;
+static long check_mismatched;
+
+long quirc_perspective_check(long *samples) {
+  long mismatched = check_mismatched;
+
+  *samples = check_samples;
+  check_samples = 0;
+  check_mismatched = 0;
+  return mismatched;
+}
+#endif
+
+static void perspective_walk_start(struct perspective_walk *w, const float *c, float u, float v, float du) {
+  w->x = c[0] * u + c[1] * v + c[2];
+  w->y = c[3] * u + c[4] * v + c[5];
+  w->den = c[6] * u + c[7] * v + 1.0f;
+  w->dx = c[0] * du;
+  w->dy = c[3] * du;
+  w->dden = c[6] * du;
+  w->inv = 1.0f / w->den;
+  w->t = 0.0f;
+#if QUIRC_PERSPECTIVE_CHECK
+  w->c = c;
+  w->u = u;
+  w->v = v;
+  w->du = du;
+#endif
+}
+
+static void perspective_walk_next(struct perspective_walk *w, struct quirc_point *ret) {
+  if (w->t > 0.0f) {
+    float den = w->den + w->t * w->dden;
+
+    w->inv *= 2.0f - den * w->inv;
+    w->inv *= 2.0f - den * w->inv;
+  }
+
+  ret->x = fast_roundf((w->x + w->t * w->dx) * w->inv);
+  ret->y = fast_roundf((w->y + w->t * w->dy) * w->inv);
+
+#if QUIRC_PERSPECTIVE_CHECK
+  {
+    struct quirc_point exact;
+
+    perspective_map(w->c, w->u + w->t * w->du, w->v, &exact);
+    check_mismatched += exact.x != ret->x || exact.y != ret->y;
+    check_samples++;
+  }
+#endif
+
+  w->t += 1.0f;
+}
+#endif
+
 /************************************************************************
  * Span-based floodfill routine
  */
 
 typedef void (*span_func_t)(void *user_data, int y, int left, int right);
 
-typedef struct xylf {
-  int16_t x, y, l, r;
-} __attribute__((aligned(8))) xylf_t;
-
 // 计算该区域的面积，from是像素颜色，to是区块标号，user_data是申请的区块结构体，func是计算面积的函数
 static void flood_fill_seed(struct quirc *q, int x, int y, int from, int to, span_func_t func, void *user_data,
                             int depth) {
   (void)depth; // unused
 
-  lifo_t lifo;
-  size_t lifo_len;
-  lifo_alloc_all(&lifo, &lifo_len, sizeof(xylf_t));
-  // late in first out. 申请xylf_t的lifo，一次申请完，长度存储在lifo_len中
+  /* Spans whose neighbours are still to be filled are kept on the
+   * recognizer's stack, which grows as needed. Only if growing fails are
+   * no new fills seeded, cutting the region short.
+   */
+  struct quirc_flood_span *stack = q->flood_stack;
+  int sp = 0;
 
   for (;;) {
     int left = x;
@@ -141,7 +215,9 @@ static void flood_fill_seed(struct quirc *q, int x, int y, int from, int to, spa
       func(user_data, y, left, right);
 
     for (;;) {
-      if (lifo_size(&lifo) < lifo_len) { // 栈中的数量
+      if (sp < q->flood_stack_len || quirc_flood_stack_grow(q) == 0) { // 栈中的数量
+        stack = q->flood_stack;
+
         /* Seed new flood-fills */
         if (y > 0) { // 查找上一行有没有在同一区域的点
           row = q->pixels + (y - 1) * q->w;
@@ -149,12 +225,11 @@ static void flood_fill_seed(struct quirc *q, int x, int y, int from, int to, spa
           bool recurse = false;
           for (i = left; i <= right; i++)
             if (row[i] == from) { // 相同区域，则入栈原来的区块
-              xylf_t context;
-              context.x = x;
-              context.y = y;
-              context.l = left;
-              context.r = right;
-              lifo_enqueue(&lifo, &context);
+              struct quirc_flood_span *context = &stack[sp++];
+              context->x = x;
+              context->y = y;
+              context->l = left;
+              context->r = right;
               // mp_printf(&mp_plat_print, "#x=%x,y=%d;x1=%d,y1=%d\n",x,y,i,y-1);
               x = i;
               y = y - 1;
@@ -171,12 +246,11 @@ static void flood_fill_seed(struct quirc *q, int x, int y, int from, int to, spa
           bool recurse = false;
           for (i = left; i <= right; i++)
             if (row[i] == from) {
-              xylf_t context;
-              context.x = x;
-              context.y = y;
-              context.l = left;
-              context.r = right;
-              lifo_enqueue(&lifo, &context);
+              struct quirc_flood_span *context = &stack[sp++];
+              context->x = x;
+              context->y = y;
+              context->l = left;
+              context->r = right;
               // mp_printf(&mp_plat_print, "#x=%x,y=%d;x1=%d,y1=%d\n",x,y,i,y+1);
               x = i;
               y = y + 1;
@@ -188,18 +262,15 @@ static void flood_fill_seed(struct quirc *q, int x, int y, int from, int to, spa
         }
       }
 
-      if (!lifo_size(&lifo)) {
-        lifo_free(&lifo); // 如果最起始为止就没找到，那么返回
+      if (!sp) // 如果最起始为止就没找到，那么返回
         return;
-      }
       // 本次迭代，往上，往下找边界（相同颜色像素点），直到找不到为止
       // 找到边界后，出栈上层像素点，回退回去
-      xylf_t context;
-      lifo_dequeue(&lifo, &context); // 这里存疑，如果都没有的话，dequeue就会反向溢出吧。。
-      x = context.x;
-      y = context.y;
-      left = context.l;
-      right = context.r;
+      sp--;
+      x = stack[sp].x;
+      y = stack[sp].y;
+      left = stack[sp].l;
+      right = stack[sp].r;
       // mp_printf(&mp_plat_print, "#deq: x=%x,y=%d\n",x,y);
     } // 找到相同from，break到这外面
   }
@@ -217,8 +288,10 @@ static void threshold(struct quirc *q) {
   int x, y;
   int avg_w = 0;
   int avg_u = 0;
-  int threshold_s = q->w / THRESHOLD_S_DEN;
+  int threshold_s = q->scan_w / THRESHOLD_S_DEN;
+  const uint8_t *src = quirc_source_row(q, 0);
   quirc_pixel_t *row = q->pixels;
+  quirc_word_t *bin = q->binary;
 
   /*
    * Ensure a sane, non-zero value for threshold_s.
@@ -231,6 +304,7 @@ static void threshold(struct quirc *q) {
 
   for (y = 0; y < q->h; y++) {
     int row_average[q->w];
+    quirc_word_t word = 0;
 
     memset(row_average, 0, sizeof(row_average));
 
@@ -245,26 +319,127 @@ static void threshold(struct quirc *q) {
         u = x;
       }
 
-      avg_w = (avg_w * (threshold_s - 1)) / threshold_s + row[w];
-      avg_u = (avg_u * (threshold_s - 1)) / threshold_s + row[u];
+      avg_w = (avg_w * (threshold_s - 1)) / threshold_s + src[w];
+      avg_u = (avg_u * (threshold_s - 1)) / threshold_s + src[u];
 
       row_average[w] += avg_w;
       row_average[u] += avg_u;
     }
 
+    /* Also pack the row into words when a binary plane is kept. Bits
+     * past the end of the row are left clear.
+     */
     for (x = 0; x < q->w; x++) {
-      if (row[x] < row_average[x] * (100 - THRESHOLD_T) / (200 * threshold_s))
-        row[x] = QUIRC_PIXEL_BLACK;
-      else
-        row[x] = QUIRC_PIXEL_WHITE;
+      int black = src[x] < row_average[x] * (100 - THRESHOLD_T) / (200 * threshold_s);
+
+      row[x] = black ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+      word |= (quirc_word_t)black << (x % QUIRC_WORD_BITS);
+      if ((x % QUIRC_WORD_BITS) == QUIRC_WORD_BITS - 1) {
+        if (bin)
+          bin[x / QUIRC_WORD_BITS] = word;
+        word = 0;
+      }
     }
 
+    if (bin) {
+      if (q->w % QUIRC_WORD_BITS)
+        bin[q->w / QUIRC_WORD_BITS] = word;
+      bin += q->binary_stride;
+    }
+
+    src += q->frame_w;
     row += q->w;
   }
 }
 
 static void area_count(void *user_data, int y, int left, int right) {
-  ((struct quirc_region *)user_data)->count += right - left + 1;
+  struct quirc_region *region = (struct quirc_region *)user_data;
+
+  region->count += right - left + 1;
+  if (left < region->box[0])
+    region->box[0] = left;
+  if (y < region->box[1])
+    region->box[1] = y;
+  if (right > region->box[2])
+    region->box[2] = right;
+  if (y > region->box[3])
+    region->box[3] = y;
+}
+
+/* Takes the next region from the pool, or returns NULL when the limit
+ * is reached. Flood fills write region codes into the label plane, so
+ * they cannot go beyond what a pixel holds. They are used with a raised
+ * limit when the run table could not grow for a frame.
+ */
+static struct quirc_region *region_new(struct quirc *q) {
+  int limit = q->max_regions;
+
+  if (q->num_runs < 0 && limit > QUIRC_MAX_REGIONS)
+    limit = QUIRC_MAX_REGIONS;
+
+  if (q->num_regions >= limit)
+    return NULL;
+
+  if (q->num_regions >= q->regions_len && quirc_regions_grow(q) < 0)
+    return NULL;
+
+  return &q->regions[q->num_regions++];
+}
+
+/* Index of the run covering (x, y), or -1 if the pixel is white */
+static int run_at(const struct quirc *q, int x, int y) {
+  int lo = q->row_runs[y];
+  int hi = q->row_runs[y + 1];
+
+  /* Find the last run of the row starting at or before x */
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+
+    if (q->runs[mid].left <= x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == q->row_runs[y] || x > q->runs[lo - 1].right)
+    return -1;
+
+  return lo - 1;
+}
+
+/* Region code of the run covering (x, y), assigning one to its
+ * component on first use. Regions are taken from the totals that the
+ * labeller kept on the root run.
+ */
+static int region_code_runs(struct quirc *q, int x, int y) {
+  int i = run_at(q, x, y);
+  struct quirc_run *root;
+  struct quirc_region *box;
+
+  if (i < 0)
+    return -1;
+
+  root = &q->runs[q->runs[i].parent];
+  if (root->region >= 0)
+    return root->region;
+
+  box = region_new(q);
+  if (!box)
+    return -1;
+
+  root->region = box - q->regions;
+
+  box->seed.x = x;
+  box->seed.y = y;
+  box->count = root->count;
+  box->capstone = -1;
+  box->box[0] = root->box_left;
+  box->box[1] = root->y;
+  box->box[2] = root->box_right;
+  box->box[3] = root->box_bottom;
+  box->run = i;
+
+  return root->region;
 }
 
 static int region_code(struct quirc *q, int x,
@@ -276,6 +451,9 @@ static int region_code(struct quirc *q, int x,
   if (x < 0 || y < 0 || x >= q->w || y >= q->h)
     return -1;
 
+  if (q->num_runs >= 0)
+    return region_code_runs(q, x, y);
+
   pixel = q->pixels[y * q->w + x];
   // 预先判断非正常的像素情况，退出
   if (pixel >= QUIRC_PIXEL_REGION)
@@ -284,23 +462,118 @@ static int region_code(struct quirc *q, int x,
   if (pixel == QUIRC_PIXEL_WHITE)
     return -1;
 
-  if (q->num_regions >= QUIRC_MAX_REGIONS)
-    return -1;
   // 新建一个区域
-  region = q->num_regions;
-  box = &q->regions[q->num_regions++];
+  box = region_new(q);
+  if (!box)
+    return -1;
+
+  region = box - q->regions;
 
   memset(box, 0, sizeof(*box));
 
   box->seed.x = x;
   box->seed.y = y;
   box->capstone = -1;
+  box->box[0] = x;
+  box->box[1] = y;
+  box->box[2] = x;
+  box->box[3] = y;
+  box->run = -1;
   // 计算该区域的面积
   flood_fill_seed(q, x, y, pixel, region, area_count, box, 0);
 
   return region;
 }
 
+/* First run of row y touching left..right that the current walk has not
+ * visited yet, or -1.
+ */
+static int run_unvisited(const struct quirc *q, int y, int left, int right) {
+  int lo = q->row_runs[y];
+  int hi = q->row_runs[y + 1];
+
+  /* Skip the runs that end before left */
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+
+    if (q->runs[mid].right < left)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (; lo < q->row_runs[y + 1] && q->runs[lo].left <= right; lo++)
+    if (q->runs[lo].walk != q->run_walk)
+      return lo;
+
+  return -1;
+}
+
+/* Visits the runs of a region in the order flood_fill_seed() would fill
+ * them from its seed: depth first, the row above before the row below,
+ * left to right. Corner searches keep the first of equally good points,
+ * so this keeps their results the same in both labelling modes.
+ */
+static void run_walk(struct quirc *q, int i, span_func_t func, void *user_data) {
+  struct quirc_flood_span *stack = q->flood_stack;
+  int sp = 0;
+
+  q->run_walk++;
+
+  for (;;) {
+    struct quirc_run *run = &q->runs[i];
+
+    run->walk = q->run_walk;
+    func(user_data, run->y, run->left, run->right);
+
+    for (;;) {
+      int next = -1;
+
+      if (sp < q->flood_stack_len || quirc_flood_stack_grow(q) == 0) {
+        stack = q->flood_stack;
+
+        if (run->y > 0)
+          next = run_unvisited(q, run->y - 1, run->left, run->right);
+        if (next < 0 && run->y < q->h - 1)
+          next = run_unvisited(q, run->y + 1, run->left, run->right);
+      }
+
+      if (next >= 0) {
+        stack[sp].x = run->left;
+        stack[sp].y = run->y;
+        stack[sp].l = run->left;
+        stack[sp].r = run->right;
+        sp++;
+        i = next;
+        break;
+      }
+
+      if (!sp)
+        return;
+
+      sp--;
+      run = &q->runs[run_at(q, stack[sp].x, stack[sp].y)];
+    }
+  }
+}
+
+/* Call func for every span of a region. Labelled runs are visited
+ * without touching the pixels. A flood filled region is walked by
+ * filling it from one colour to another, so callers walk it twice to
+ * put its code back.
+ */
+static void region_walk(struct quirc *q, int rcode, int from, int to, span_func_t func, void *user_data) {
+  const struct quirc_region *region = &q->regions[rcode];
+
+  if (region->run < 0) {
+    flood_fill_seed(q, region->seed.x, region->seed.y, from, to, func, user_data, 0);
+    return;
+  }
+
+  if (func)
+    run_walk(q, region->run, func, user_data);
+}
+
 struct polygon_score_data {
   struct quirc_point ref;
 
@@ -358,7 +631,7 @@ static void find_region_corners(struct quirc *q, int rcode, const struct quirc_p
 
   memcpy(&psd.ref, ref, sizeof(psd.ref));
   psd.scores[0] = -1;
-  flood_fill_seed(q, region->seed.x, region->seed.y, rcode, QUIRC_PIXEL_BLACK, find_one_corner, &psd, 0);
+  region_walk(q, rcode, rcode, QUIRC_PIXEL_BLACK, find_one_corner, &psd);
 
   psd.ref.x = psd.corners[0].x - psd.ref.x;
   psd.ref.y = psd.corners[0].y - psd.ref.y;
@@ -373,7 +646,7 @@ static void find_region_corners(struct quirc *q, int rcode, const struct quirc_p
   psd.scores[1] = i;
   psd.scores[3] = -i;
 
-  flood_fill_seed(q, region->seed.x, region->seed.y, QUIRC_PIXEL_BLACK, rcode, find_other_corners, &psd, 0);
+  region_walk(q, rcode, QUIRC_PIXEL_BLACK, rcode, find_other_corners, &psd);
 }
 
 static void record_capstone(struct quirc *q, int ring, int stone) {
@@ -430,6 +703,13 @@ static void test_capstone(struct quirc *q, int x, int y, int *pb) {
   if (stone_reg->capstone >= 0 || ring_reg->capstone >= 0)
     return;
 
+  /* Ring should enclose stone. Blobs of data modules can pass the run
+   * and area tests, but rarely surround what they touch.
+   */
+  if (stone_reg->box[0] <= ring_reg->box[0] || stone_reg->box[1] <= ring_reg->box[1]
+      || stone_reg->box[2] >= ring_reg->box[2] || stone_reg->box[3] >= ring_reg->box[3])
+    return;
+
   /* Ratio should ideally be 37.5 中间实心点占面积比例应该在37.5%左右*/
   ratio = stone_reg->count * 100 / ring_reg->count;
   if (ratio < 10 || ratio > 70)
@@ -438,6 +718,22 @@ static void test_capstone(struct quirc *q, int x, int y, int *pb) {
   record_capstone(q, ring_left, stone);
 }
 
+/* Check the last five runs ending at x for the 1:1:3:1:1 finder ratio */
+static void finder_test_runs(struct quirc *q, int x, int y, int *pb) {
+  static int check[5] = {1, 1, 3, 1, 1};
+  int avg, err;
+  int i;
+
+  avg = (pb[0] + pb[1] + pb[3] + pb[4]) / 4;
+  err = avg * 3 / 4;
+
+  for (i = 0; i < 5; i++)
+    if (pb[i] < check[i] * avg - err || pb[i] > check[i] * avg + err)
+      return;
+
+  test_capstone(q, x, y, pb);
+}
+
 static void finder_scan(struct quirc *q, int y) {
   quirc_pixel_t *row = q->pixels + y * q->w;
   int x;
@@ -456,27 +752,190 @@ static void finder_scan(struct quirc *q, int y) {
       run_length = 0;
       run_count++; // get more than 5 time color jump
 
-      if (!color && run_count >= 5) { // find the marker of QRcode(three corner's marker)
-        static int check[5] = {1, 1, 3, 1, 1};
-        int avg, err;
-        int i;
-        int ok = 1;
+      if (!color && run_count >= 5) // find the marker of QRcode(three corner's marker)
+        finder_test_runs(q, x, y, pb);
+    }
 
-        avg = (pb[0] + pb[1] + pb[3] + pb[4]) / 4;
-        err = avg * 3 / 4;
+    run_length++;
+    last_color = color;
+  }
+}
 
-        for (i = 0; i < 5; i++)
-          if (pb[i] < check[i] * avg - err || pb[i] > check[i] * avg + err)
-            ok = 0;
+/* Return the first position at or after x whose colour differs from
+ * the given one, or w if the row ends first.
+ */
+static int packed_next_edge(const quirc_word_t *row, int stride, int w, int x, int color) {
+  const quirc_word_t flip = color ? ~(quirc_word_t)0 : 0;
+  int i = x / QUIRC_WORD_BITS;
+  quirc_word_t t;
+
+  if (x >= w)
+    return w;
+
+  t = (row[i] ^ flip) & (~(quirc_word_t)0 << (x % QUIRC_WORD_BITS));
+  while (!t) {
+    if (++i >= stride)
+      return w;
+    t = row[i] ^ flip;
+  }
 
-        if (ok)
-          test_capstone(q, x, y, pb);
-      }
+  x = i * QUIRC_WORD_BITS + quirc_word_ctz(t);
+  return x < w ? x : w;
+}
+
+/* Same as finder_scan(), but hops from one run boundary to the next
+ * using the bit-packed plane instead of visiting every pixel.
+ */
+static void finder_scan_packed(struct quirc *q, int y) {
+  const quirc_word_t *row = q->binary + y * q->binary_stride;
+  int color = row[0] & 1;
+  int run_start = 0;
+  int run_count = 0;
+  int pb[5];
+
+  memset(pb, 0, sizeof(pb));
+  for (;;) {
+    int x = packed_next_edge(row, q->binary_stride, q->w, run_start, color);
+
+    if (x >= q->w)
+      break;
+
+    memmove(pb, pb + 1, sizeof(pb[0]) * 4);
+    pb[4] = x - run_start;
+    run_start = x;
+    run_count++;
+    color = !color;
+
+    if (!color && run_count >= 5)
+      finder_test_runs(q, x, y, pb);
+  }
+}
+
+/************************************************************************
+ * Run-based connected component labelling
+ */
+
+static int run_find(struct quirc_run *runs, int i) {
+  while (runs[i].parent != i) {
+    runs[i].parent = runs[runs[i].parent].parent;
+    i = runs[i].parent;
+  }
+
+  return i;
+}
+
+/* Merge two components. The root with the lower index, which is the
+ * first in raster order, survives and takes the other's totals.
+ */
+static void run_union(struct quirc_run *runs, int a, int b) {
+  struct quirc_run *ra;
+  struct quirc_run *rb;
+
+  a = run_find(runs, a);
+  b = run_find(runs, b);
+  if (a == b)
+    return;
+
+  if (a > b) {
+    int t = a;
+
+    a = b;
+    b = t;
+  }
+
+  ra = &runs[a];
+  rb = &runs[b];
+  rb->parent = a;
+  ra->count += rb->count;
+  if (rb->box_left < ra->box_left)
+    ra->box_left = rb->box_left;
+  if (rb->box_right > ra->box_right)
+    ra->box_right = rb->box_right;
+  if (rb->box_bottom > ra->box_bottom)
+    ra->box_bottom = rb->box_bottom;
+}
+
+/* Start of the next black run at or after x, or w */
+static int row_next_black(struct quirc *q, const quirc_pixel_t *row, const quirc_word_t *bin, int x) {
+  if (bin)
+    return packed_next_edge(bin, q->binary_stride, q->w, x, 0);
+
+  while (x < q->w && row[x] == QUIRC_PIXEL_WHITE)
+    x++;
+  return x;
+}
+
+/* End of the black run containing x, exclusive */
+static int row_next_white(struct quirc *q, const quirc_pixel_t *row, const quirc_word_t *bin, int x) {
+  if (bin)
+    return packed_next_edge(bin, q->binary_stride, q->w, x, 1);
+
+  while (x < q->w && row[x] != QUIRC_PIXEL_WHITE)
+    x++;
+  return x;
+}
+
+/* Sweep the thresholded working area once, joining each black run to
+ * the runs it touches in the row above (4-connectivity, as the flood
+ * fill), then point each run at the root of its component. Returns
+ * -1 if the run table could not grow, in which case regions are flood
+ * filled as before.
+ */
+static int label_runs(struct quirc *q) {
+  int n = 0;
+  int prev = 0;
+  int x, y, i;
+
+  for (y = 0; y < q->h; y++) {
+    const quirc_pixel_t *row = q->pixels + y * q->w;
+    const quirc_word_t *bin = q->binary ? q->binary + y * q->binary_stride : NULL;
+    int row_start = n;
+    int p = prev;
+
+    q->row_runs[y] = n;
+
+    for (x = row_next_black(q, row, bin, 0); x < q->w; x = row_next_black(q, row, bin, x)) {
+      struct quirc_run *run;
+      int right = row_next_white(q, row, bin, x) - 1;
+      int k;
+
+      if (n >= q->runs_len && quirc_runs_grow(q) < 0)
+        return -1;
+
+      run = &q->runs[n];
+      run->y = y;
+      run->left = x;
+      run->right = right;
+      run->box_left = x;
+      run->box_right = right;
+      run->box_bottom = y;
+      run->parent = n;
+      run->walk = 0;
+      run->count = right - x + 1;
+      run->region = -1;
+
+      /* Runs above that end before this one can't touch later ones either */
+      while (p < row_start && q->runs[p].right < x)
+        p++;
+      for (k = p; k < row_start && q->runs[k].left <= right; k++)
+        run_union(q->runs, k, n);
+
+      n++;
+      x = right + 1;
     }
 
-    run_length++;
-    last_color = color;
+    prev = row_start;
   }
+
+  q->row_runs[q->h] = n;
+
+  /* Point every run straight at its root */
+  for (i = 0; i < n; i++)
+    q->runs[i].parent = run_find(q->runs, i);
+
+  q->num_runs = n;
+  q->run_walk = 0;
+  return 0;
 }
 
 static void find_alignment_pattern(struct quirc *q, int index) {
@@ -666,45 +1125,71 @@ static int measure_timing_pattern(struct quirc *q, int index) {
   /* Choose the nearest allowable grid size */
   size = scan * 2 + 13;
   ver = (size - 15) / 4;
+  if (ver > QUIRC_MAX_VERSION)
+    return -1;
+
   qr->grid_size = ver * 4 + 17;
 
   return 0;
 }
 
-/* Read a cell from a grid using the currently set perspective
- * transform. Returns +/- 1 for black/white, 0 for cells which are
- * out of image bounds.
+/* Returns +/- 1 for a black/white pixel, 0 if it is out of bounds */
+static int read_pixel(const struct quirc *q, const struct quirc_point *p) {
+  if (p->y < 0 || p->y >= q->h || p->x < 0 || p->x >= q->w)
+    return 0;
+
+  return q->pixels[p->y * q->w + p->x] ? 1 : -1;
+}
+
+/* Read row y of a grid using the currently set perspective transform,
+ * setting the bits of black cells in the bitmap from bit i onwards.
+ * Cells which are out of image bounds read as white.
  */
-static int read_cell(const struct quirc *q, int index, int x, int y) {
+static void read_row(const struct quirc *q, int index, int y, uint8_t *bitmap, int i) {
   const struct quirc_grid *qr = &q->grids[index];
   struct quirc_point p;
-
-  perspective_map(qr->c, x + 0.5, y + 0.5, &p);
-  if (p.y < 0 || p.y >= q->h || p.x < 0 || p.x >= q->w)
-    return 0;
-
-  return q->pixels[p.y * q->w + p.x] ? 1 : -1;
+  int x;
+#if QUIRC_STEPPED_PERSPECTIVE
+  struct perspective_walk walk;
+
+  perspective_walk_start(&walk, qr->c, 0.5f, y + 0.5f, 1.0f);
+#endif
+
+  for (x = 0; x < qr->grid_size; x++, i++) {
+#if QUIRC_STEPPED_PERSPECTIVE
+    perspective_walk_next(&walk, &p);
+#else
+    perspective_map(qr->c, x + 0.5, y + 0.5, &p);
+#endif
+    if (read_pixel(q, &p) > 0)
+      bitmap[i >> 3] |= (1 << (i & 7));
+  }
 }
 
 static int fitness_cell(const struct quirc *q, int index, int x, int y) {
+  static const float offsets[] = {0.3, 0.5, 0.7};
   const struct quirc_grid *qr = &q->grids[index];
   int score = 0;
   int u, v;
 
-  for (v = 0; v < 3; v++)
+  for (v = 0; v < 3; v++) {
+#if QUIRC_STEPPED_PERSPECTIVE
+    struct perspective_walk walk;
+
+    perspective_walk_start(&walk, qr->c, x + offsets[0], y + offsets[v], offsets[1] - offsets[0]);
+#endif
+
     for (u = 0; u < 3; u++) {
-      static const float offsets[] = {0.3, 0.5, 0.7};
       struct quirc_point p;
 
+#if QUIRC_STEPPED_PERSPECTIVE
+      perspective_walk_next(&walk, &p);
+#else
       perspective_map(qr->c, x + offsets[u], y + offsets[v], &p);
-      if (p.y < 0 || p.y >= q->h || p.x < 0 || p.x >= q->w)
-        continue;
-
-      if (q->pixels[p.y * q->w + p.x])
-        score++;
-      else
-        score--;
+#endif
+      score += read_pixel(q, &p);
     }
+  }
 
   return score;
 }
@@ -735,17 +1220,55 @@ static int fitness_capstone(const struct quirc *q, int index, int x, int y) {
          fitness_ring(q, index, x, y, 3);
 }
 
+/* Highest scores of the features, with every sample as expected */
+#define FITNESS_CELL_MAX 9
+#define FITNESS_CAPSTONE_MAX (FITNESS_CELL_MAX * 49)
+#define FITNESS_APAT_MAX (FITNESS_CELL_MAX * 25)
+
+/* Number of alignment patterns along each side of the grid */
+static int grid_ap_count(const struct quirc_grid *qr) {
+  int version = (qr->grid_size - 17) / 4;
+  const struct quirc_version_info *info;
+  int ap_count = 0;
+
+  if (version < 0 || version > QUIRC_MAX_VERSION)
+    return 0;
+
+  info = &quirc_version_db[version];
+  while ((ap_count < QUIRC_MAX_ALIGNMENT) && info->apat[ap_count])
+    ap_count++;
+
+  return ap_count;
+}
+
+/* The score fitness_all() gives a grid which fits perfectly */
+static int fitness_max(const struct quirc_grid *qr) {
+  int ap_count = grid_ap_count(qr);
+  int score = (qr->grid_size - 14) * 2 * FITNESS_CELL_MAX + 3 * FITNESS_CAPSTONE_MAX;
+
+  if (ap_count > 2)
+    score += (ap_count - 2) * 2 * FITNESS_APAT_MAX;
+  if (ap_count > 1)
+    score += (ap_count - 1) * (ap_count - 1) * FITNESS_APAT_MAX;
+
+  return score;
+}
+
 /* Compute a fitness score for the currently configured perspective
  * transform, using the features we expect to find by scanning the
  * grid.
+ *
+ * Scoring stops as soon as the features left can no longer lift the
+ * score above bound, in which case some score no greater than bound is
+ * returned. Pass INT_MIN for the full score.
  */
-static int fitness_all(const struct quirc *q, int index) {
+static int fitness_all(const struct quirc *q, int index, int bound) {
   const struct quirc_grid *qr = &q->grids[index];
-  int version = (qr->grid_size - 17) / 4;
-  const struct quirc_version_info *info = &quirc_version_db[version];
+  const struct quirc_version_info *info = &quirc_version_db[(qr->grid_size - 17) / 4];
+  int ap_count = grid_ap_count(qr);
+  int left = fitness_max(qr);
   int score = 0;
   int i, j;
-  int ap_count;
 
   /* Check the timing pattern */
   for (i = 0; i < qr->grid_size - 14; i++) {
@@ -753,36 +1276,43 @@ static int fitness_all(const struct quirc *q, int index) {
 
     score += fitness_cell(q, index, i + 7, 6) * expect;
     score += fitness_cell(q, index, 6, i + 7) * expect;
+    left -= 2 * FITNESS_CELL_MAX;
+    if (score + left <= bound)
+      return score + left;
   }
 
   /* Check capstones */
   score += fitness_capstone(q, index, 0, 0);
   score += fitness_capstone(q, index, qr->grid_size - 7, 0);
   score += fitness_capstone(q, index, 0, qr->grid_size - 7);
-
-  if (version < 0 || version > QUIRC_MAX_VERSION)
-    return score;
+  left -= 3 * FITNESS_CAPSTONE_MAX;
+  if (score + left <= bound)
+    return score + left;
 
   /* Check alignment patterns */
-  ap_count = 0;
-  while ((ap_count < QUIRC_MAX_ALIGNMENT) && info->apat[ap_count])
-    ap_count++;
-
   for (i = 1; i + 1 < ap_count; i++) {
     score += fitness_apat(q, index, 6, info->apat[i]);
     score += fitness_apat(q, index, info->apat[i], 6);
+    left -= 2 * FITNESS_APAT_MAX;
+    if (score + left <= bound)
+      return score + left;
   }
 
   for (i = 1; i < ap_count; i++)
-    for (j = 1; j < ap_count; j++)
+    for (j = 1; j < ap_count; j++) {
       score += fitness_apat(q, index, info->apat[i], info->apat[j]);
-  // mp_printf(&mp_plat_print, "##score=%d\n",score);
+      left -= FITNESS_APAT_MAX;
+      if (score + left <= bound)
+        return score + left;
+    }
+
   return score;
 }
 
 static void jiggle_perspective(struct quirc *q, int index) {
   struct quirc_grid *qr = &q->grids[index];
-  int best = fitness_all(q, index);
+  int best = fitness_all(q, index, INT_MIN);
+  int max = fitness_max(qr);
   int pass;
   float adjustments[8];
   int i;
@@ -798,13 +1328,17 @@ static void jiggle_perspective(struct quirc *q, int index) {
       float step = adjustments[j];
       float new;
 
+      /* Nothing can do better than a perfect fit */
+      if (best >= max)
+        return;
+
       if (i & 1)
         new = old + step;
       else
         new = old - step;
 
       qr->c[j] = new;
-      test = fitness_all(q, index);
+      test = fitness_all(q, index, best);
 
       if (test > best)
         best = test;
@@ -817,6 +1351,78 @@ static void jiggle_perspective(struct quirc *q, int index) {
   }
 }
 
+/************************************************************************
+ * Temporal tracking
+ *
+ * After a frame in which grids were found, their perspective transforms
+ * are kept in frame coordinates, and grids found in the next frame start
+ * from them where they fit better. The whole region of interest is still
+ * scanned on every frame, so that codes arriving elsewhere are found.
+ * With a coarse pass, the window around the tracked codes is also
+ * searched at full resolution when the coarse image lost them.
+ */
+
+/* Shift a perspective transform so that its output moves by (dx, dy) */
+static void perspective_translate(float *c, float dx, float dy) {
+  c[0] += dx * c[6];
+  c[1] += dx * c[7];
+  c[2] += dx;
+  c[3] += dy * c[6];
+  c[4] += dy * c[7];
+  c[5] += dy;
+}
+
+/* If a grid of the same size was tracked near this one, start from
+ * whichever perspective fits the current image better.
+ */
+static void track_seed_perspective(struct quirc *q, int index) {
+  struct quirc_grid *qr = &q->grids[index];
+  struct quirc_point center;
+  int best = INT_MIN; /* Not scored yet, fitness can be negative */
+  int i;
+
+  if (!q->tracking)
+    return;
+
+  perspective_map(qr->c, qr->grid_size * 0.5, qr->grid_size * 0.5, &center);
+
+  for (i = 0; i < q->num_tracks; i++) {
+    const struct quirc_track *t = &q->tracks[i];
+    float old[QUIRC_PERSPECTIVE_PARAMS];
+    struct quirc_point tc;
+    int test;
+
+    if (t->grid_size != qr->grid_size)
+      continue;
+
+    memcpy(old, qr->c, sizeof(old));
+    memcpy(qr->c, t->c, sizeof(qr->c));
+    perspective_translate(qr->c, -q->origin_x, -q->origin_y);
+    perspective_map(qr->c, qr->grid_size * 0.5, qr->grid_size * 0.5, &tc);
+
+    /* Only consider codes which have moved by less than a quarter of
+     * their width.
+     */
+    if (abs(tc.x - center.x) * 4 > t->width || abs(tc.y - center.y) * 4 > t->width) {
+      memcpy(qr->c, old, sizeof(old));
+      continue;
+    }
+
+    if (best == INT_MIN) {
+      memcpy(qr->c, old, sizeof(old));
+      best = fitness_all(q, index, INT_MIN);
+      memcpy(qr->c, t->c, sizeof(qr->c));
+      perspective_translate(qr->c, -q->origin_x, -q->origin_y);
+    }
+
+    test = fitness_all(q, index, best);
+    if (test > best)
+      best = test;
+    else
+      memcpy(qr->c, old, sizeof(old));
+  }
+}
+
 /* Once the capstones are in place and an alignment point has been
  * chosen, we call this function to set up a grid-reading perspective
  * transform.
@@ -832,6 +1438,7 @@ static void setup_qr_perspective(struct quirc *q, int index) {
   memcpy(&rect[3], &q->capstones[qr->caps[0]].corners[0], sizeof(rect[0]));
   perspective_setup(qr->c, rect, qr->grid_size - 7, qr->grid_size - 7);
 
+  track_seed_perspective(q, index);
   jiggle_perspective(q, index);
 }
 
@@ -907,6 +1514,9 @@ static void record_qr_grid(struct quirc *q, int a, int b, int c) {
     cap->qr_grid = qr_index;
   }
 
+  if (q->grid_hypotheses)
+    return;
+
   /* Check the timing pattern. This doesn't require a perspective
    * transform.
    */
@@ -939,8 +1549,8 @@ static void record_qr_grid(struct quirc *q, int a, int b, int c) {
       psd.corners = &qr->align;
       psd.scores[0] = -hd.y * qr->align.x + hd.x * qr->align.y;
 
-      flood_fill_seed(q, reg->seed.x, reg->seed.y, qr->align_region, QUIRC_PIXEL_BLACK, NULL, NULL, 0);
-      flood_fill_seed(q, reg->seed.x, reg->seed.y, QUIRC_PIXEL_BLACK, qr->align_region, find_leftmost_to_line, &psd, 0);
+      region_walk(q, qr->align_region, qr->align_region, QUIRC_PIXEL_BLACK, NULL, NULL);
+      region_walk(q, qr->align_region, QUIRC_PIXEL_BLACK, qr->align_region, find_leftmost_to_line, &psd);
     }
   }
 
@@ -1043,71 +1653,463 @@ static void test_grouping(struct quirc *q, int i) {
   test_neighbours(q, i, &hlist, &vlist);
 }
 
+/* The label plane aliases the image buffer unless it is owned separately.
+ * threshold() reads from q->source and writes the plane, so no separate
+ * copy of the input is needed in either case.
+ */
 static void pixels_setup(struct quirc *q) {
-  if (sizeof(*q->image) == sizeof(*q->pixels)) {
+  if (!quirc_pixels_owned(q))
     q->pixels = (quirc_pixel_t *)q->image;
-  } else {
-    int x, y;
-    for (y = 0; y < q->h; y++) {
-      for (x = 0; x < q->w; x++) {
-        q->pixels[y * q->w + x] = q->image[y * q->w + x];
-      }
-    }
-  }
 }
 
-uint8_t *quirc_begin(struct quirc *q, int *w, int *h) {
+/* Clip a rectangle, given by its corners, to another. Returns 0 if
+ * nothing is left.
+ */
+static int clip_rect(int *r, const int *bounds) {
+  int i;
+
+  for (i = 0; i < 2; i++)
+    if (r[i] < bounds[i])
+      r[i] = bounds[i];
+  for (i = 2; i < 4; i++)
+    if (r[i] > bounds[i])
+      r[i] = bounds[i];
+
+  return r[0] < r[2] && r[1] < r[3];
+}
+
+/* The requested region of interest clipped to the frame, or the whole
+ * frame if there is none.
+ */
+static void roi_rect(const struct quirc *q, int *r) {
+  const int frame[4] = {0, 0, q->frame_w, q->frame_h};
+
+  r[0] = q->roi_x;
+  r[1] = q->roi_y;
+  r[2] = q->roi_x + q->roi_w;
+  r[3] = q->roi_y + q->roi_h;
+
+  if (q->roi_w <= 0 || q->roi_h <= 0 || !clip_rect(r, frame))
+    memcpy(r, frame, sizeof(frame));
+}
+
+/* Make the given rectangle of the frame the working area. The label
+ * plane is packed at the working width, which never overtakes the input
+ * rows still to be read when it aliases them.
+ */
+static void area_setup(struct quirc *q, const int *r) {
+  q->origin_x = r[0];
+  q->origin_y = r[1];
+  q->w = r[2] - r[0];
+  q->h = r[3] - r[1];
+}
+
+static void reset_results(struct quirc *q) {
   q->num_regions = QUIRC_PIXEL_REGION;
+  q->num_runs = -1;
   q->num_capstones = 0;
   q->num_grids = 0;
+}
+
+uint8_t *quirc_begin(struct quirc *q, int *w, int *h) {
+  reset_results(q);
+  q->source = q->image;
 
   if (w)
-    *w = q->w;
+    *w = q->frame_w;
   if (h)
-    *h = q->h;
+    *h = q->frame_h;
 
   return q->image;
 }
 
-void quirc_end(struct quirc *q) {
+void quirc_begin_borrowed(struct quirc *q, const uint8_t *image) {
+  reset_results(q);
+  q->source = image;
+}
+
+/* Remember the grids found in this frame and the window around them in
+ * which the next frame is searched at full resolution.
+ */
+static void track_update(struct quirc *q) {
+  int i, j;
+
+  q->num_tracks = 0;
+  for (i = 0; i < q->num_grids; i++) {
+    struct quirc_grid *qr = &q->grids[i];
+    struct quirc_track *t = &q->tracks[q->num_tracks++];
+    int box[4] = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+    int margin;
+
+    for (j = 0; j < 4; j++) {
+      struct quirc_point p;
+
+      perspective_map(qr->c, (j == 1 || j == 2) ? qr->grid_size : 0, (j >= 2) ? qr->grid_size : 0, &p);
+      p.x += q->origin_x;
+      p.y += q->origin_y;
+
+      if (p.x < box[0])
+        box[0] = p.x;
+      if (p.y < box[1])
+        box[1] = p.y;
+      if (p.x > box[2])
+        box[2] = p.x;
+      if (p.y > box[3])
+        box[3] = p.y;
+    }
+
+    t->grid_size = qr->grid_size;
+    t->width = box[2] - box[0];
+    if (box[3] - box[1] > t->width)
+      t->width = box[3] - box[1];
+    memcpy(t->c, qr->c, sizeof(t->c));
+    perspective_translate(t->c, q->origin_x, q->origin_y);
+
+    /* Leave room for the code to move by half its size */
+    margin = t->width / 2;
+    box[0] -= margin;
+    box[1] -= margin;
+    box[2] += margin + 1;
+    box[3] += margin + 1;
+
+    if (!i) {
+      memcpy(q->track_window, box, sizeof(box));
+    } else {
+      for (j = 0; j < 2; j++)
+        if (box[j] < q->track_window[j])
+          q->track_window[j] = box[j];
+      for (j = 2; j < 4; j++)
+        if (box[j] > q->track_window[j])
+          q->track_window[j] = box[j];
+    }
+  }
+}
+
+/* Adds the ticks since *start to a stage and restarts the count */
+static void stage_done(struct quirc *q, quirc_stage_t stage, uint32_t *start) {
+  uint32_t now;
+
+  if (!q->stage_clock)
+    return;
+
+  now = q->stage_clock();
+  q->stage_ticks[stage] += now - *start;
+  *start = now;
+}
+
+static void process_area(struct quirc *q, const int *r) {
+  uint32_t start = q->stage_clock ? q->stage_clock() : 0;
   int i;
+
+  reset_results(q);
+  area_setup(q, r);
   pixels_setup(q);
-  threshold(q);
 
-  for (i = 0; i < q->h; i++) {
-    finder_scan(q, i);
+  switch (q->threshold_method) {
+  case QUIRC_THRESHOLD_BOX:
+    if (q->box_sums && q->source != (const uint8_t *)q->pixels) {
+      quirc_threshold_box(q);
+      break;
+    }
+    threshold(q);
+    break;
+
+  case QUIRC_THRESHOLD_OTSU:
+    quirc_threshold_otsu(q);
+    break;
+
+  default:
+    threshold(q);
+    break;
+  }
+  stage_done(q, QUIRC_STAGE_THRESHOLD, &start);
+
+  if (q->run_labels && q->runs)
+    label_runs(q);
+  stage_done(q, QUIRC_STAGE_LABEL, &start);
+
+  if (q->binary) {
+    for (i = 0; i < q->h; i++)
+      finder_scan_packed(q, i);
+  } else {
+    for (i = 0; i < q->h; i++)
+      finder_scan(q, i);
   }
+  stage_done(q, QUIRC_STAGE_FINDERS, &start);
 
   for (i = 0; i < q->num_capstones; i++) {
     test_grouping(q, i);
   }
+  stage_done(q, QUIRC_STAGE_GRIDS, &start);
+}
+
+/* Grows a box, left, top, right and bottom, to take in a point */
+static void box_include(int *box, int x, int y) {
+  if (x < box[0])
+    box[0] = x;
+  if (y < box[1])
+    box[1] = y;
+  if (x > box[2])
+    box[2] = x;
+  if (y > box[3])
+    box[3] = y;
+}
+
+/* Averages each s x s block of the input into one output pixel. Inlined
+ * with a constant s, so the block loops unroll.
+ */
+static inline __attribute__((always_inline)) void downsample(const uint8_t *in, int stride, uint8_t *out, int w,
+                                                             int h, const int s) {
+  int x, y, i, j;
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *row = in + y * s * stride;
+
+    for (x = 0; x < w; x++) {
+      const uint8_t *block = row + x * s;
+      int sum = 0;
+
+      for (i = 0; i < s; i++)
+        for (j = 0; j < s; j++)
+          sum += block[i * stride + j];
+
+      *out++ = sum / (s * s);
+    }
+  }
+}
+
+/* Shrinks the area into the image of the coarse recognizer, which is
+ * sized to match.
+ */
+static void pyramid_downsample(const struct quirc *q, const int *r, struct quirc *coarse) {
+  const uint8_t *in = q->source + r[1] * q->frame_w + r[0];
+  uint8_t *out = quirc_begin(coarse, NULL, NULL);
+
+  if (q->pyramid_scale == 2)
+    downsample(in, q->frame_w, out, coarse->frame_w, coarse->frame_h, 2);
+  else
+    downsample(in, q->frame_w, out, coarse->frame_w, coarse->frame_h, 4);
+}
+
+/* Makes the coarse recognizer match the settings of the full one. The
+ * setters do nothing when a setting is unchanged. Its labels are kept
+ * apart from the shrunk image so the box filter can be used.
+ */
+static int pyramid_setup(struct quirc *q, const int *r) {
+  struct quirc *coarse = q->pyramid;
+  const int s = q->pyramid_scale;
+  int max_regions = q->max_regions / (s * s);
+
+  coarse->grid_hypotheses = 1;
+  /* The shrunk copy gets the same share of the run table as of regions */
+  coarse->max_runs = q->max_runs ? q->max_runs / (s * s) + 1 : 0;
+  /* The default limit is valid in either labelling mode */
+  quirc_set_max_regions(coarse, QUIRC_MAX_REGIONS);
+  if (quirc_set_separate_labels(coarse, 1) < 0 || quirc_set_packed_scan(coarse, q->packed_scan) < 0
+      || quirc_set_run_labels(coarse, q->run_labels) < 0 || quirc_set_threshold(coarse, q->threshold_method) < 0)
+    return -1;
+
+  if (max_regions > QUIRC_MAX_REGIONS)
+    quirc_set_max_regions(coarse, max_regions);
+  quirc_set_stage_clock(coarse, q->stage_clock);
+
+  return quirc_resize(coarse, (r[2] - r[0]) / s, (r[3] - r[1]) / s);
+}
+
+/* Finds the part of the area that is worth processing at full
+ * resolution from a pass over a shrunk copy of it. Grids there are only
+ * grouped, not fitted, and each gives the box around its capstones and
+ * the one opposite the corner capstone. Capstones left over, if there
+ * are at least two, may belong to a code whose third one was missed,
+ * so the box around them is widened by half its larger side to take in
+ * the rest of the code. Returns 0 if nothing was found, or -1 if the
+ * coarse pass couldn't be run.
+ */
+static int pyramid_window(struct quirc *q, const int *r, int *window) {
+  struct quirc *coarse = q->pyramid;
+  const int s = q->pyramid_scale;
+  int caps[4] = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+  int num_caps = 0;
+  int cap_size = 0;
+  int found = 0;
+  uint32_t start = q->stage_clock ? q->stage_clock() : 0;
+  int i, j;
+
+  if ((r[2] - r[0]) / s < QUIRC_PYRAMID_MIN_SIZE || (r[3] - r[1]) / s < QUIRC_PYRAMID_MIN_SIZE
+      || pyramid_setup(q, r) < 0)
+    return -1;
+
+  pyramid_downsample(q, r, coarse);
+  stage_done(q, QUIRC_STAGE_THRESHOLD, &start);
+
+  quirc_end(coarse);
+  for (i = 0; i < QUIRC_STAGE_COUNT; i++)
+    q->stage_ticks[i] += coarse->stage_ticks[i];
+
+  window[0] = window[1] = INT_MAX;
+  window[2] = window[3] = INT_MIN;
+
+  for (i = 0; i < coarse->num_grids; i++) {
+    const struct quirc_grid *qr = &coarse->grids[i];
+    const struct quirc_capstone *a = &coarse->capstones[qr->caps[0]];
+    const struct quirc_capstone *b = &coarse->capstones[qr->caps[1]];
+    const struct quirc_capstone *c = &coarse->capstones[qr->caps[2]];
+    int box[4] = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+    int margin;
+
+    for (j = 0; j < 4; j++) {
+      box_include(box, a->corners[j].x, a->corners[j].y);
+      box_include(box, b->corners[j].x, b->corners[j].y);
+      box_include(box, c->corners[j].x, c->corners[j].y);
+      box_include(box, a->corners[j].x + c->corners[j].x - b->corners[j].x,
+                  a->corners[j].y + c->corners[j].y - b->corners[j].y);
+    }
+
+    /* Perspective may push the fourth corner further out, and the
+     * finder scan needs a few modules of quiet zone
+     */
+    margin = (box[2] - box[0] + box[3] - box[1]) / 16 + 2;
+    box_include(window, box[0] - margin, box[1] - margin);
+    box_include(window, box[2] + margin + 1, box[3] + margin + 1);
+    found = 1;
+  }
+
+  for (i = 0; i < coarse->num_capstones; i++) {
+    const struct quirc_capstone *cap = &coarse->capstones[i];
+
+    if (cap->qr_grid >= 0)
+      continue;
+
+    for (j = 0; j < 4; j++)
+      box_include(caps, cap->corners[j].x, cap->corners[j].y);
+    j = abs(cap->corners[2].x - cap->corners[0].x) + abs(cap->corners[2].y - cap->corners[0].y);
+    if (j > cap_size)
+      cap_size = j;
+    num_caps++;
+  }
+
+  if (num_caps >= 2) {
+    int side = caps[2] - caps[0] > caps[3] - caps[1] ? caps[2] - caps[0] : caps[3] - caps[1];
+    int margin = side / 2 + cap_size / 2 + 2;
+
+    box_include(window, caps[0] - margin, caps[1] - margin);
+    box_include(window, caps[2] + margin + 1, caps[3] + margin + 1);
+    found = 1;
+  }
+
+  if (!found)
+    return 0;
+
+  /* Back to frame coordinates, and no further than the area */
+  for (i = 0; i < 4; i++)
+    window[i] = window[i] * s + r[i & 1];
+  return clip_rect(window, r);
+}
+
+void quirc_end(struct quirc *q) {
+  int roi[4];
+  int window[4];
+  int found;
+
+  memset(q->stage_ticks, 0, sizeof(q->stage_ticks));
+  roi_rect(q, roi);
+  q->scan_w = roi[2] - roi[0];
+  q->scan_h = roi[3] - roi[1];
+
+  found = q->pyramid ? pyramid_window(q, roi, window) : -1;
+
+  /* Codes of the last frame stay in the window even if the coarse pass
+   * missed them
+   */
+  if (found >= 0 && q->tracking && q->num_tracks) {
+    int tracked[4];
+
+    memcpy(tracked, q->track_window, sizeof(tracked));
+    if (clip_rect(tracked, roi)) {
+      if (found) {
+        box_include(window, tracked[0], tracked[1]);
+        box_include(window, tracked[2], tracked[3]);
+      } else {
+        memcpy(window, tracked, sizeof(window));
+        found = 1;
+      }
+    }
+  }
+
+  /* When the coarse pass saw nothing, codes too small for it may still
+   * be there, so the whole area is processed at full resolution
+   */
+  if (found > 0)
+    process_area(q, window);
+  else
+    process_area(q, roi);
+
+  if (q->tracking)
+    track_update(q);
+}
+
+void quirc_set_tracking(struct quirc *q, int enable) {
+  q->tracking = !!enable;
+  q->num_tracks = 0;
+}
+
+/* Samples both copies of the format information, 30 cells against the
+ * size * size of the whole grid. Returns -1 if neither can be corrected.
+ */
+static int read_format_cells(const struct quirc *q, int index, struct quirc_code *code) {
+  const struct quirc_grid *qr = &q->grids[index];
+  int which, k;
+
+  for (which = 0; which < 2; which++) {
+    for (k = 0; k < QUIRC_FORMAT_BITS; k++) {
+      struct quirc_point p;
+      int x, y, i;
+
+      quirc_format_cell(qr->grid_size, which, k, &x, &y);
+      perspective_map(qr->c, x + 0.5, y + 0.5, &p);
+
+      i = y * qr->grid_size + x;
+      if (read_pixel(q, &p) > 0)
+        code->cell_bitmap[i >> 3] |= (1 << (i & 7));
+    }
+  }
+
+  return quirc_check_format(code);
 }
 
 void quirc_extract(const struct quirc *q, int index, struct quirc_code *code) {
   const struct quirc_grid *qr = &q->grids[index];
+  int bitmap_bytes;
   int y;
-  int i = 0;
+  int i;
 
-  if (index < 0 || index > q->num_grids)
+  if (index < 0 || index >= q->num_grids)
     return;
 
-  memset(code, 0, sizeof(*code));
+  /* The bitmap is cleared only as far as this grid's cells */
+  bitmap_bytes = (qr->grid_size * qr->grid_size + 7) >> 3;
+  memset(code, 0, offsetof(struct quirc_code, cell_bitmap));
+  memset(code->cell_bitmap, 0, bitmap_bytes);
 
   perspective_map(qr->c, 0.0, 0.0, &code->corners[0]);
   perspective_map(qr->c, qr->grid_size, 0.0, &code->corners[1]);
   perspective_map(qr->c, qr->grid_size, qr->grid_size, &code->corners[2]);
   perspective_map(qr->c, 0.0, qr->grid_size, &code->corners[3]);
 
-  code->size = qr->grid_size;
+  for (i = 0; i < 4; i++) {
+    code->corners[i].x += q->origin_x;
+    code->corners[i].y += q->origin_y;
+  }
 
-  for (y = 0; y < qr->grid_size; y++) {
-    int x;
+  code->size = qr->grid_size;
 
-    for (x = 0; x < qr->grid_size; x++) {
-      if (read_cell(q, index, x, y) > 0)
-        code->cell_bitmap[i >> 3] |= (1 << (i & 7));
+  /* Without readable format information the grid can't be decoded, so
+   * only those cells are returned.
+   */
+  if (read_format_cells(q, index, code) < 0)
+    return;
 
-      i++;
-    }
-  }
+  memset(code->cell_bitmap, 0, bitmap_bytes);
+  for (y = 0; y < qr->grid_size; y++)
+    read_row(q, index, y, code->cell_bitmap, y * qr->grid_size);
 }
\ No newline at end of file
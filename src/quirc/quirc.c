@@ -15,7 +15,6 @@
  */
 
 #include "quirc_internal.h"
-#include <Arduino.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -29,46 +28,371 @@ struct quirc *quirc_new(void) {
     return NULL;
 
   memset(q, 0, sizeof(*q));
+  q->max_regions = QUIRC_MAX_REGIONS;
   return q;
 }
 
 void quirc_destroy(struct quirc *q) {
+  if (!q)
+    return;
+
   if (q->image)
-    if (q->image)
-      free(q->image);
-  if (sizeof(*q->image) != sizeof(*q->pixels))
-    if (q->pixels)
-      free(q->pixels);
+    free(q->image);
+  if (quirc_pixels_owned(q) && q->pixels)
+    free(q->pixels);
+  if (q->binary)
+    free(q->binary);
+  if (q->box_sums)
+    free(q->box_sums);
+  if (q->flood_stack)
+    free(q->flood_stack);
+  if (q->runs)
+    free(q->runs);
+  if (q->row_runs)
+    free(q->row_runs);
+  if (q->regions)
+    free(q->regions);
+  quirc_destroy(q->pyramid);
+
+  free(q);
+}
+
+static quirc_word_t *binary_alloc(int w, int h, int *stride) {
+  *stride = (w + QUIRC_WORD_BITS - 1) / QUIRC_WORD_BITS;
+  return ps_malloc(*stride * h * sizeof(quirc_word_t));
+}
+
+/* Column sums followed by a row prefix sum for the box filter */
+static uint32_t *box_sums_alloc(int w) { return ps_malloc((w * 2 + 1) * sizeof(uint32_t)); }
+
+int quirc_flood_stack_grow(struct quirc *q) {
+  int len = q->flood_stack_len * 2;
+  struct quirc_flood_span *stack = ps_malloc(len * sizeof(*stack));
+
+  if (!stack)
+    return -1;
+
+  memcpy(stack, q->flood_stack, q->flood_stack_len * sizeof(*stack));
+  free(q->flood_stack);
+  q->flood_stack = stack;
+  q->flood_stack_len = len;
+  return 0;
+}
+
+/* Room for a run every 64 pixels to begin with. Busy scenes grow it. */
+static struct quirc_run *runs_alloc(int w, int h, int max_runs, int *len) {
+  *len = w * h / 64 + 1;
+  if (max_runs && *len > max_runs)
+    *len = max_runs;
+  return ps_malloc(*len * sizeof(struct quirc_run));
+}
+
+int quirc_runs_grow(struct quirc *q) {
+  int len = q->runs_len * 2;
+  struct quirc_run *runs;
+
+  /* The old table is still held while the new one is filled */
+  if (q->max_runs && len > q->max_runs - q->runs_len)
+    len = q->max_runs - q->runs_len;
+  if (len <= q->runs_len)
+    return -1;
+
+  runs = ps_malloc(len * sizeof(*runs));
+  if (!runs)
+    return -1;
+
+  memcpy(runs, q->runs, q->runs_len * sizeof(*runs));
+  free(q->runs);
+  q->runs = runs;
+  q->runs_len = len;
+  return 0;
+}
+
+int quirc_regions_grow(struct quirc *q) {
+  int len = q->regions_len ? q->regions_len * 2 : QUIRC_REGIONS_INITIAL;
+  struct quirc_region *regions;
+
+  if (len > q->max_regions)
+    len = q->max_regions;
+  if (len <= q->regions_len)
+    return -1;
+
+  regions = ps_malloc(len * sizeof(*regions));
+  if (!regions)
+    return -1;
 
-  if (q)
-    free(q);
+  if (q->regions) {
+    memcpy(regions, q->regions, q->num_regions * sizeof(*regions));
+    free(q->regions);
+  }
+  q->regions = regions;
+  q->regions_len = len;
+  return 0;
 }
 
 // static quirc_pixel_t img_buf[320*240];
 int quirc_resize(struct quirc *q, int w, int h) {
-  if (q->image) {
-    free(q->image);
-  }
-  uint8_t *new_image = ps_malloc(w * h);
+  uint8_t *new_image;
+  quirc_pixel_t *new_pixels = NULL;
+  quirc_word_t *new_binary = NULL;
+  uint32_t *new_box_sums = NULL;
+  struct quirc_flood_span *new_flood_stack;
+  struct quirc_run *new_runs = NULL;
+  int *new_row_runs = NULL;
+  int new_stride = 0;
+  int new_runs_len = 0;
+
+  /* Keep the existing buffers when the geometry does not change, so that
+   * a long-lived recognizer can be resized once per frame for free.
+   */
+  if (q->image && q->frame_w == w && q->frame_h == h)
+    return 0;
 
+  new_image = ps_malloc(w * h);
   if (!new_image)
     return -1;
 
-  if (sizeof(*q->image) != sizeof(*q->pixels)) { // should gray, 1==1
-    size_t new_size = w * h * sizeof(quirc_pixel_t);
+  new_flood_stack = ps_malloc(h * sizeof(*new_flood_stack));
+  if (!new_flood_stack)
+    goto fail;
+
+  if (quirc_pixels_owned(q)) {
+    new_pixels = ps_malloc(w * h * sizeof(quirc_pixel_t));
+    if (!new_pixels)
+      goto fail;
+  }
+
+  if (q->packed_scan) {
+    new_binary = binary_alloc(w, h, &new_stride);
+    if (!new_binary)
+      goto fail;
+  }
+
+  if (q->run_labels) {
+    new_runs = runs_alloc(w, h, q->max_runs, &new_runs_len);
+    new_row_runs = ps_malloc((h + 1) * sizeof(int));
+    if (!new_runs || !new_row_runs)
+      goto fail;
+  }
+
+  if (q->threshold_method == QUIRC_THRESHOLD_BOX) {
+    new_box_sums = box_sums_alloc(w);
+    if (!new_box_sums)
+      goto fail;
+  }
+
+  if (q->image)
+    free(q->image);
+  q->image = new_image;
+
+  if (q->flood_stack)
+    free(q->flood_stack);
+  q->flood_stack = new_flood_stack;
+  q->flood_stack_len = h;
+
+  if (quirc_pixels_owned(q)) {
     if (q->pixels)
       free(q->pixels);
-    quirc_pixel_t *new_pixels = ps_malloc(new_size);
-    if (!new_pixels) {
-      free(new_image);
-      return -1;
-    }
     q->pixels = new_pixels;
   }
-  q->image = new_image;
+
+  if (q->packed_scan) {
+    if (q->binary)
+      free(q->binary);
+    q->binary = new_binary;
+    q->binary_stride = new_stride;
+  }
+
+  if (q->run_labels) {
+    if (q->runs)
+      free(q->runs);
+    if (q->row_runs)
+      free(q->row_runs);
+    q->runs = new_runs;
+    q->runs_len = new_runs_len;
+    q->row_runs = new_row_runs;
+  }
+
+  if (q->threshold_method == QUIRC_THRESHOLD_BOX) {
+    if (q->box_sums)
+      free(q->box_sums);
+    q->box_sums = new_box_sums;
+  }
+
+  q->frame_w = w;
+  q->frame_h = h;
   q->w = w;
   q->h = h;
   return 0;
+
+fail:
+  if (new_row_runs)
+    free(new_row_runs);
+  if (new_runs)
+    free(new_runs);
+  if (new_binary)
+    free(new_binary);
+  if (new_pixels)
+    free(new_pixels);
+  free(new_flood_stack);
+  free(new_image);
+  return -1;
+}
+
+int quirc_set_separate_labels(struct quirc *q, int enable) {
+  enable = !!enable;
+  if (enable == q->separate_labels)
+    return 0;
+
+  if (sizeof(*q->image) != sizeof(*q->pixels)) {
+    /* The label plane is always separate for wide pixels */
+    q->separate_labels = enable;
+    return 0;
+  }
+
+  if (enable) {
+    quirc_pixel_t *new_pixels = NULL;
+
+    if (q->image) {
+      new_pixels = ps_malloc(q->frame_w * q->frame_h * sizeof(quirc_pixel_t));
+      if (!new_pixels)
+        return -1;
+    }
+    q->pixels = new_pixels;
+  } else {
+    if (q->pixels)
+      free(q->pixels);
+    q->pixels = NULL;
+  }
+
+  q->separate_labels = enable;
+  return 0;
+}
+
+int quirc_set_packed_scan(struct quirc *q, int enable) {
+  enable = !!enable;
+  if (enable == q->packed_scan)
+    return 0;
+
+  if (enable) {
+    if (q->image) {
+      q->binary = binary_alloc(q->frame_w, q->frame_h, &q->binary_stride);
+      if (!q->binary)
+        return -1;
+    }
+  } else {
+    if (q->binary)
+      free(q->binary);
+    q->binary = NULL;
+  }
+
+  q->packed_scan = enable;
+  return 0;
+}
+
+int quirc_set_run_labels(struct quirc *q, int enable) {
+  enable = !!enable;
+  if (enable == q->run_labels)
+    return 0;
+
+  /* Flood fills could not label that many regions */
+  if (!enable && q->max_regions > QUIRC_MAX_REGIONS)
+    return -1;
+
+  if (enable) {
+    if (q->image) {
+      q->runs = runs_alloc(q->frame_w, q->frame_h, q->max_runs, &q->runs_len);
+      q->row_runs = ps_malloc((q->frame_h + 1) * sizeof(int));
+      if (!q->runs || !q->row_runs) {
+        if (q->runs)
+          free(q->runs);
+        if (q->row_runs)
+          free(q->row_runs);
+        q->runs = NULL;
+        q->row_runs = NULL;
+        return -1;
+      }
+    }
+  } else {
+    if (q->runs)
+      free(q->runs);
+    if (q->row_runs)
+      free(q->row_runs);
+    q->runs = NULL;
+    q->row_runs = NULL;
+  }
+
+  q->run_labels = enable;
+  return 0;
+}
+
+int quirc_set_threshold(struct quirc *q, quirc_threshold_t method) {
+  if (method < QUIRC_THRESHOLD_MOVING_AVERAGE || method > QUIRC_THRESHOLD_OTSU)
+    return -1;
+
+  if (method == QUIRC_THRESHOLD_BOX) {
+    if (!q->box_sums && q->image) {
+      q->box_sums = box_sums_alloc(q->frame_w);
+      if (!q->box_sums)
+        return -1;
+    }
+  } else if (q->box_sums) {
+    free(q->box_sums);
+    q->box_sums = NULL;
+  }
+
+  q->threshold_method = method;
+  return 0;
+}
+
+void quirc_set_max_run_bytes(struct quirc *q, int bytes) {
+  q->max_runs = bytes > 0 ? bytes / (int)sizeof(struct quirc_run) : 0;
+  if (bytes > 0 && !q->max_runs)
+    q->max_runs = 1;
+}
+
+int quirc_set_max_regions(struct quirc *q, int max) {
+  if (max <= QUIRC_PIXEL_REGION || (!q->run_labels && max > QUIRC_MAX_REGIONS))
+    return -1;
+
+  q->max_regions = max;
+  return 0;
+}
+
+void quirc_set_roi(struct quirc *q, int x, int y, int w, int h) {
+  q->roi_x = x;
+  q->roi_y = y;
+  q->roi_w = w;
+  q->roi_h = h;
+}
+
+int quirc_set_pyramid(struct quirc *q, int scale) {
+  if (scale != 1 && scale != 2 && scale != 4)
+    return -1;
+
+  if (scale > 1 && !q->pyramid) {
+    q->pyramid = quirc_new();
+    if (!q->pyramid)
+      return -1;
+  } else if (scale == 1) {
+    quirc_destroy(q->pyramid);
+    q->pyramid = NULL;
+  }
+
+  q->pyramid_scale = scale;
+  return 0;
+}
+
+void quirc_set_stage_clock(struct quirc *q, uint32_t (*clock)(void)) {
+  q->stage_clock = clock;
+  memset(q->stage_ticks, 0, sizeof(q->stage_ticks));
+}
+
+uint32_t quirc_stage_ticks(const struct quirc *q, quirc_stage_t stage) {
+  if (stage < 0 || stage >= QUIRC_STAGE_COUNT)
+    return 0;
+
+  return q->stage_ticks[stage];
 }
 
 int quirc_count(const struct quirc *q) { return q->num_grids; }
@@ -80,7 +404,8 @@ static const char *const error_table[] = {[QUIRC_SUCCESS] = "Success",
                                           [QUIRC_ERROR_DATA_ECC] = "ECC failure",
                                           [QUIRC_ERROR_UNKNOWN_DATA_TYPE] = "Unknown data type",
                                           [QUIRC_ERROR_DATA_OVERFLOW] = "Data overflow",
-                                          [QUIRC_ERROR_DATA_UNDERFLOW] = "Data underflow"};
+                                          [QUIRC_ERROR_DATA_UNDERFLOW] = "Data underflow",
+                                          [QUIRC_ERROR_OUT_OF_MEMORY] = "Out of memory"};
 
 const char *quirc_strerror(quirc_decode_error_t err) {
   if (err >= 0 && err < sizeof(error_table) / sizeof(error_table[0]))
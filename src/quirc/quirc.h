@@ -40,8 +40,11 @@ extern "C"
   /* Resize the QR-code recognizer. The size of an image must be
  * specified before codes can be analyzed.
  *
+ * Resizing to the current geometry keeps the existing buffers, so a
+ * recognizer may be created once and resized before every frame.
+ *
  * This function returns 0 on success, or -1 if sufficient memory could
- * not be allocated.
+ * not be allocated. On failure the previous buffers are left intact.
  */
   int quirc_resize(struct quirc *q, int w, int h);
 
@@ -57,6 +60,151 @@ extern "C"
   uint8_t *quirc_begin(struct quirc *q, int *w, int *h);
   void quirc_end(struct quirc *q);
 
+  /* Alternative to quirc_begin() which processes a caller-owned grayscale
+ * image of the size last given to quirc_resize(), without copying it.
+ * The buffer is only read, and must stay valid until quirc_end()
+ * returns. The recognizer's own image buffer is used as scratch space
+ * for the thresholded and labelled plane.
+ */
+  void quirc_begin_borrowed(struct quirc *q, const uint8_t *image);
+
+  /* Keep the thresholded and labelled plane in a buffer of its own
+ * instead of overwriting the image obtained from quirc_begin(). The
+ * input then survives quirc_end(), which may be called again on the
+ * same image without refilling it.
+ *
+ * This function returns 0 on success, or -1 if the plane could not be
+ * allocated.
+ */
+  int quirc_set_separate_labels(struct quirc *q, int enable);
+
+  /* Also keep a bit-packed copy of the thresholded image and scan it a
+ * word at a time when looking for finder patterns. This costs w * h / 8
+ * bytes and is usually several times faster than the per-pixel scan.
+ *
+ * This function returns 0 on success, or -1 if the plane could not be
+ * allocated.
+ */
+  int quirc_set_packed_scan(struct quirc *q, int enable);
+
+  /* Label every black region in one sweep over the runs of each row,
+ * instead of flood filling regions as the finder scan reaches them.
+ * The cost per frame then depends on the number of runs rather than on
+ * where the fills wander, and region corners are found from the stored
+ * runs without walking the pixels again. The run table starts at one
+ * run per 64 pixels and grows for busy images.
+ *
+ * This function returns 0 on success, or -1 if the run table could not
+ * be allocated. Disabling it also fails while the region limit is above
+ * the default, which has to be lowered first.
+ */
+  int quirc_set_run_labels(struct quirc *q, int enable);
+
+  /* Limit the memory of the run table, counting the old table that is
+ * still held while it grows, to about this many bytes. The table itself
+ * stops growing at half to two thirds of that. Regions of an image with
+ * more runs than fit are flood filled, so no more than the default
+ * number of them are labelled. 0, the default, lets the table grow for
+ * as long as there is memory.
+ */
+  void quirc_set_max_run_bytes(struct quirc *q, int bytes);
+
+  /* Limit the number of regions labelled in one image. Each black blob
+ * the finder scan or the alignment search touches uses one, and once
+ * they run out no further capstones are found, so busy or large images
+ * may need more than the default of 254. The region pool grows on
+ * demand up to this limit, about 40 bytes per region.
+ *
+ * Only run labelling can go beyond the default, since flood filling
+ * writes region codes into the 8-bit label plane. Enable it first.
+ *
+ * This function returns 0 on success, or -1 if the limit is too small,
+ * or above the default without run labelling.
+ */
+  int quirc_set_max_regions(struct quirc *q, int max);
+
+  /* Thresholding methods used to binarize the image. */
+  typedef enum
+  {
+    /* Serpentine moving average along each row (default) */
+    QUIRC_THRESHOLD_MOVING_AVERAGE = 0,
+    /* Mean of a square window of about w / 8 pixels around each pixel */
+    QUIRC_THRESHOLD_BOX,
+    /* Single global level chosen with Otsu's method */
+    QUIRC_THRESHOLD_OTSU
+  } quirc_threshold_t;
+
+  /* Select the thresholding method used by quirc_end(). The box filter
+ * needs the input to stay intact while it slides, so it is only used
+ * with quirc_begin_borrowed() or a separate label plane. Otherwise it
+ * falls back to the moving average.
+ *
+ * This function returns 0 on success, or -1 if the method is unknown or
+ * its scratch space could not be allocated.
+ */
+  int quirc_set_threshold(struct quirc *q, quirc_threshold_t method);
+
+  /* Restrict recognition to a rectangle of the image. Thresholding, the
+ * finder scan and region filling only touch pixels inside it, and the
+ * corners returned by quirc_extract() are still in image coordinates.
+ * The rectangle is clipped to the image on each quirc_end(). Pass a
+ * zero width or height to process the whole image again.
+ */
+  void quirc_set_roi(struct quirc *q, int x, int y, int w, int h);
+
+  /* Track codes from one image to the next. When the previous image
+ * contained codes, quirc_end() starts each grid found near one of them
+ * from the previous perspective if that fits better. The whole image
+ * (or region of interest) is still scanned every time, so codes that
+ * arrive elsewhere are found as well. With a coarse pass, the area
+ * around the previous codes is searched at full resolution even when
+ * the coarse image doesn't show them. Enabling or disabling tracking
+ * forgets past codes.
+ */
+  void quirc_set_tracking(struct quirc *q, int enable);
+
+  /* Look for codes in a copy of the image (or region of interest) shrunk
+ * by a factor of 2 or 4 first. Only the part of the image around the
+ * grids and finder patterns found there is then processed at full
+ * resolution, where the codes are sampled. Codes whose finder patterns
+ * are narrower than about 7 pixels in the shrunk copy are only found
+ * when the coarse pass finds nothing at all, in which case the whole
+ * image is processed at full resolution. A factor of 1 turns the
+ * coarse pass off.
+ *
+ * With tracking, the area around the previous codes is processed as
+ * well. The stages of the coarse pass are timed with those of the full
+ * pass.
+ *
+ * This function returns 0 on success, or -1 if the factor is not 1, 2
+ * or 4 or the coarse recognizer could not be allocated.
+ */
+  int quirc_set_pyramid(struct quirc *q, int scale);
+
+  /* Stages of quirc_end() that can be timed. */
+  typedef enum
+  {
+    /* Binarizing the image */
+    QUIRC_STAGE_THRESHOLD = 0,
+    /* Collecting black runs, with run labelling */
+    QUIRC_STAGE_LABEL,
+    /* Finder scan, including the flood fills it starts */
+    QUIRC_STAGE_FINDERS,
+    /* Grouping capstones and fitting grids */
+    QUIRC_STAGE_GRIDS,
+    QUIRC_STAGE_COUNT
+  } quirc_stage_t;
+
+  /* Time the stages of quirc_end() with a clock that returns ticks, for
+ * example microseconds. Pass NULL to stop timing.
+ */
+  void quirc_set_stage_clock(struct quirc *q, uint32_t (*clock)(void));
+
+  /* Return the ticks a stage took in the last quirc_end(), or 0 if no
+ * clock is set.
+ */
+  uint32_t quirc_stage_ticks(const struct quirc *q, quirc_stage_t stage);
+
   /* This structure describes a location in the input image buffer. */
   struct quirc_point
   {
@@ -74,7 +222,8 @@ extern "C"
     QUIRC_ERROR_DATA_ECC,
     QUIRC_ERROR_UNKNOWN_DATA_TYPE,
     QUIRC_ERROR_DATA_OVERFLOW,
-    QUIRC_ERROR_DATA_UNDERFLOW
+    QUIRC_ERROR_DATA_UNDERFLOW,
+    QUIRC_ERROR_OUT_OF_MEMORY
   } quirc_decode_error_t;
 
   /* Return a string error message for an error code. */
@@ -83,6 +232,7 @@ extern "C"
 /* Limits on the maximum size of QR-codes and their content. */
 #define QUIRC_MAX_BITMAP 3917
 #define QUIRC_MAX_PAYLOAD 8896
+#define QUIRC_MAX_CODEWORDS 3706
 
 /* QR-code ECC types. */
 #define QUIRC_ECC_LEVEL_M 0
@@ -163,14 +313,50 @@ extern "C"
  */
   int quirc_count(const struct quirc *q);
 
-  /* Extract the QR-code specified by the given index. */
+  /* Extract the QR-code specified by the given index. The format
+ * information is sampled first, and if neither copy of it can be
+ * corrected no other cells are read.
+ */
   void quirc_extract(const struct quirc *q, int index,
                      struct quirc_code *code);
 
-  /* Decode a QR-code, returning the payload data. */
+  /* Working memory for quirc_decode_with_scratch(). Apart from the
+ * clock it needn't be initialized, and nothing in it is kept between
+ * calls.
+ */
+  struct quirc_decode_scratch
+  {
+    /* Codewords as read from the grid, with one spare byte for the
+     * remainder bits.
+     */
+    uint8_t raw[QUIRC_MAX_CODEWORDS + 1];
+
+    /* Data codewords after error correction */
+    uint8_t data[QUIRC_MAX_CODEWORDS];
+
+    /* Clock that times error correction, as for quirc_set_stage_clock(),
+     * or NULL. The ticks it took are left in ecc_ticks, which is 0 if
+     * decoding failed before the codewords were corrected.
+     */
+    uint32_t (*clock)(void);
+    uint32_t ecc_ticks;
+  };
+
+  /* Decode a QR-code, returning the payload data. Returns
+   * QUIRC_ERROR_OUT_OF_MEMORY if the scratch space can't be allocated.
+   */
   quirc_decode_error_t quirc_decode(const struct quirc_code *code,
                                     struct quirc_data *data);
 
+  /* Decode a QR-code using caller-provided working memory, so that
+ * nothing is allocated. Only as much of the scratch space as the code's
+ * version needs is cleared. Payload bytes after the nul terminator are
+ * left as they were.
+ */
+  quirc_decode_error_t quirc_decode_with_scratch(const struct quirc_code *code,
+                                                 struct quirc_data *data,
+                                                 struct quirc_decode_scratch *scratch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,14 +19,34 @@
 
 #include "quirc.h"
 
+/* Large buffers live in PSRAM on the ESP32. Elsewhere they come from the
+ * regular heap, which lets the library build on the host.
+ */
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdlib.h>
+#define ps_malloc malloc
+#endif
+
 #define QUIRC_PIXEL_WHITE 0
 #define QUIRC_PIXEL_BLACK 1
 #define QUIRC_PIXEL_REGION 2
 
+/* Region codes the label plane can hold. This is also the default limit
+ * set by quirc_new(); run labelling may raise it with
+ * quirc_set_max_regions().
+ */
 #ifndef QUIRC_MAX_REGIONS
 #define QUIRC_MAX_REGIONS 254
 #endif
 
+/* Entries in the region pool when it is first needed */
+#define QUIRC_REGIONS_INITIAL 64
+
+/* Smallest shrunk area worth a coarse pass, in pixels across */
+#define QUIRC_PYRAMID_MIN_SIZE 32
+
 #define QUIRC_MAX_CAPSTONES 32
 #define QUIRC_MAX_GRIDS 8
 
@@ -40,11 +60,82 @@ typedef uint16_t quirc_pixel_t;
 #error "QUIRC_MAX_REGIONS > 65534 is not supported"
 #endif
 
+/* Sample grid cells by walking the perspective transform along each row
+ * of samples, with one divide per row instead of two per sample. Set to
+ * 0 to map every sample on its own.
+ */
+#ifndef QUIRC_STEPPED_PERSPECTIVE
+#define QUIRC_STEPPED_PERSPECTIVE 1
+#endif
+
+/* Host builds only, for quirc_bench -w: every sample the walk takes is
+ * also mapped with a divide, and quirc_perspective_check() counts those
+ * that land on a different pixel.
+ */
+#ifndef QUIRC_PERSPECTIVE_CHECK
+#define QUIRC_PERSPECTIVE_CHECK 0
+#endif
+
+#if QUIRC_PERSPECTIVE_CHECK && !QUIRC_STEPPED_PERSPECTIVE
+#error "QUIRC_PERSPECTIVE_CHECK needs QUIRC_STEPPED_PERSPECTIVE"
+#endif
+
+/* Highest version whose data module positions and mask planes are kept
+ * in a table once decoded, at about 3 bytes per data module. Larger
+ * versions walk the grid cell by cell on every decode.
+ */
+#ifndef QUIRC_DATA_MAP_MAX_VERSION
+#define QUIRC_DATA_MAP_MAX_VERSION 10
+#endif
+
+/* Word size of the bit-packed binary plane. Pixels are stored LSB first,
+ * so pixel x of a row is bit (x % QUIRC_WORD_BITS) of its word.
+ */
+#ifndef QUIRC_WORD_BITS
+#define QUIRC_WORD_BITS 32
+#endif
+
+#if QUIRC_WORD_BITS == 32
+typedef uint32_t quirc_word_t;
+#define quirc_word_ctz(x) __builtin_ctz(x)
+#elif QUIRC_WORD_BITS == 64
+typedef uint64_t quirc_word_t;
+#define quirc_word_ctz(x) __builtin_ctzll(x)
+#else
+#error "QUIRC_WORD_BITS must be 32 or 64"
+#endif
+
+/* Extent of a span whose neighbouring rows are still being filled */
+struct quirc_flood_span
+{
+  int16_t x, y, l, r;
+} __attribute__((aligned(8)));
+
+/* A horizontal run of black pixels found by the run labeller. The first
+ * run of a component in raster order is the root of its union-find tree
+ * and keeps the component's totals.
+ */
+struct quirc_run
+{
+  int16_t y;
+  int16_t left;
+  int16_t right;
+  int16_t box_left; /* Bounding box, on the root only. Its top is y. */
+  int16_t box_right;
+  int16_t box_bottom;
+  int32_t parent;
+  int32_t walk; /* Last region walk that visited the run */
+  int32_t count; /* Pixels of the component, on the root only */
+  int32_t region; /* Region code, on the root only, or -1 */
+};
+
 struct quirc_region
 {
   struct quirc_point seed;
   int count;
   int capstone;
+  int box[4]; /* Left, top, right, bottom */
+  int run; /* Run under the seed, or -1 if the region was flood filled */
 } __attribute__((aligned(8)));
 
 struct quirc_capstone
@@ -78,23 +169,153 @@ struct quirc_grid
   float c[QUIRC_PERSPECTIVE_PARAMS];
 } __attribute__((aligned(8)));
 
+struct quirc_track
+{
+  int grid_size;
+  int width; /* Larger side of the bounding box, in pixels */
+  float c[QUIRC_PERSPECTIVE_PARAMS]; /* In frame coordinates */
+} __attribute__((aligned(8)));
+
 struct quirc
 {
   uint8_t *image;
+  const uint8_t *source; /* Frame read by quirc_end(): image or a borrowed buffer */
   quirc_pixel_t *pixels;
+  int separate_labels; /* Keep the label plane apart from image */
+  quirc_word_t *binary; /* Bit-packed black/white plane, or NULL */
+  int binary_stride;    /* Words per row of binary */
+  int packed_scan;
+  quirc_threshold_t threshold_method;
+  uint32_t *box_sums; /* Scratch for QUIRC_THRESHOLD_BOX, or NULL */
+
+  /* Span stack shared by all flood fills. It starts at one entry per
+   * frame row and doubles whenever a fill needs more.
+   */
+  struct quirc_flood_span *flood_stack;
+  int flood_stack_len;
+
+  /* Black runs of the working area in raster order when run labelling
+   * is enabled, with the index of the first run of each row (frame_h + 1
+   * entries). num_runs is -1 when regions are flood filled instead.
+   * max_runs, if not 0, bounds runs_len plus the table copied from
+   * while growing.
+   */
+  int run_labels;
+  struct quirc_run *runs;
+  int runs_len;
+  int max_runs;
+  int num_runs;
+  int *row_runs;
+  int run_walk;
+
+  /* The working area is processed as an image of its own, w x h pixels,
+   * whose top-left corner is at (origin_x, origin_y) in the frame.
+   */
   int w;
   int h;
+  int frame_w;
+  int frame_h;
+  int origin_x;
+  int origin_y;
+
+  /* Size of the whole region of interest. Local thresholds scale their
+   * window with it rather than with the working area, so a part of the
+   * region processed on its own is binarized the same way.
+   */
+  int scan_w;
+  int scan_h;
+
+  /* Requested region of interest, empty for the whole frame */
+  int roi_x;
+  int roi_y;
+  int roi_w;
+  int roi_h;
 
+  /* Region pool, regions_len entries, grown on demand. At most
+   * max_regions codes are handed out, and no more than QUIRC_MAX_REGIONS
+   * when they are written into the label plane.
+   */
   int num_regions;
-  struct quirc_region regions[QUIRC_MAX_REGIONS];
+  int max_regions;
+  struct quirc_region *regions;
+  int regions_len;
 
   int num_capstones;
   struct quirc_capstone capstones[QUIRC_MAX_CAPSTONES];
 
   int num_grids;
   struct quirc_grid grids[QUIRC_MAX_GRIDS];
+
+  /* Grids found in the previous frame, when tracking */
+  int tracking;
+  int num_tracks;
+  struct quirc_track tracks[QUIRC_MAX_GRIDS];
+  int track_window[4]; /* Left, top, right, bottom in frame coordinates */
+
+  /* Recognizer for the shrunk copy of the area, when pyramid_scale > 1 */
+  int pyramid_scale;
+  struct quirc *pyramid;
+
+  /* Only group capstones into grids, without fitting or timing them.
+   * Set for the coarse recognizer, whose grids can't be extracted.
+   */
+  int grid_hypotheses;
+
+  /* Ticks per stage of the last quirc_end(), when a clock is set */
+  uint32_t (*stage_clock)(void);
+  uint32_t stage_ticks[QUIRC_STAGE_COUNT];
 } __attribute__((aligned(8)));
 
+/* The label plane is a buffer of its own, rather than an alias of the
+ * image, when pixels are wider than 8 bits or separate labels were asked for.
+ */
+static inline int quirc_pixels_owned(const struct quirc *q)
+{
+  return sizeof(*q->image) != sizeof(*q->pixels) || q->separate_labels;
+}
+
+/* First luma pixel of row y of the working area. Rows are frame_w apart. */
+static inline const uint8_t *quirc_source_row(const struct quirc *q, int y)
+{
+  return q->source + (q->origin_y + y) * q->frame_w + q->origin_x;
+}
+
+/* Doubles the flood fill stack, keeping its contents. Returns -1 if
+ * there is no memory for it, in which case the stack is unchanged.
+ */
+int quirc_flood_stack_grow(struct quirc *q);
+
+/* Doubles the run table in the same way, or grows it as far as
+ * max_runs allows
+ */
+int quirc_runs_grow(struct quirc *q);
+
+/* Doubles the region pool, up to max_regions entries */
+int quirc_regions_grow(struct quirc *q);
+
+/* Alternative thresholding engines, in threshold.c. They read q->source
+ * and write q->pixels and, if present, q->binary.
+ */
+int quirc_box_window(const struct quirc *q);
+void quirc_threshold_box(struct quirc *q);
+void quirc_threshold_otsu(struct quirc *q);
+
+#if QUIRC_PERSPECTIVE_CHECK
+/* Returns how many of the samples walked since the last call landed on
+ * a different pixel from a divide per sample, and sets samples to the
+ * number walked.
+ */
+long quirc_perspective_check(long *samples);
+#endif
+
+/* Format information checks, in decode.c. quirc_extract() uses them to
+ * give up on a grid before sampling all of it.
+ */
+#define QUIRC_FORMAT_BITS 15
+
+void quirc_format_cell(int size, int which, int i, int *x, int *y);
+int quirc_check_format(const struct quirc_code *code);
+
 /************************************************************************
  * QR-code version information database
  */
@@ -0,0 +1,392 @@
+/* quirc -- QR-code recognition library
+ * Copyright (C) 2010-2012 Daniel Beer <dlbeer@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "quirc_internal.h"
+
+/* The vector kernels store one byte per pixel, so they are only used
+ * when the label plane is 8 bits wide. Everything else, including the
+ * ESP32 target, uses the unrolled scalar loops.
+ */
+#if QUIRC_MAX_REGIONS < UINT8_MAX
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define THRESHOLD_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define THRESHOLD_SSE2
+#endif
+#endif
+
+/************************************************************************
+ * Row packing
+ */
+
+/* Pack a thresholded row into the binary plane, pixel x in bit
+ * (x % QUIRC_WORD_BITS). Bits past the end of the row are left clear.
+ */
+static void pack_row(const quirc_pixel_t *row, quirc_word_t *out, int w) {
+  int x = 0;
+
+#if defined(THRESHOLD_AVX2) || defined(THRESHOLD_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; x + QUIRC_WORD_BITS <= w; x += QUIRC_WORD_BITS) {
+    quirc_word_t word = 0;
+    int i;
+
+    for (i = 0; i < QUIRC_WORD_BITS; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(row + x + i));
+
+      word |= (quirc_word_t)(uint16_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, zero)) << i;
+    }
+
+    *out++ = word;
+  }
+#else
+  for (; x + QUIRC_WORD_BITS <= w; x += QUIRC_WORD_BITS) {
+    quirc_word_t word = 0;
+    int i;
+
+    for (i = 0; i < QUIRC_WORD_BITS; i += 4) {
+      word |= (quirc_word_t)(row[x + i] != 0) << i;
+      word |= (quirc_word_t)(row[x + i + 1] != 0) << (i + 1);
+      word |= (quirc_word_t)(row[x + i + 2] != 0) << (i + 2);
+      word |= (quirc_word_t)(row[x + i + 3] != 0) << (i + 3);
+    }
+
+    *out++ = word;
+  }
+#endif
+
+  if (x < w) {
+    quirc_word_t word = 0;
+    int i;
+
+    for (i = 0; x + i < w; i++)
+      word |= (quirc_word_t)(row[x + i] != 0) << i;
+
+    *out = word;
+  }
+}
+
+/************************************************************************
+ * Box filter thresholding
+ *
+ * Each pixel is compared against the mean of a win x win window around
+ * it. Windows are shifted inwards at the image borders so that they
+ * always have the same area. Vertical sums are kept per column and
+ * updated as the window slides down, and each row is turned into a
+ * prefix sum so that every window sum costs one subtraction.
+ */
+
+#define BOX_WINDOW_DEN 8
+#define BOX_WINDOW_MAX 255 /* Keeps window sums below 2^24 */
+#define BOX_T 5
+
+int quirc_box_window(const struct quirc *q) {
+  int win = q->scan_w / BOX_WINDOW_DEN;
+
+  if (win > BOX_WINDOW_MAX)
+    win = BOX_WINDOW_MAX;
+  if (win > q->h)
+    win = q->h;
+  if (win > q->w)
+    win = q->w;
+  if (win < 1)
+    win = 1;
+
+  return win;
+}
+
+static void colsum_add(uint32_t *sums, const uint8_t *row, int w) {
+  int x = 0;
+
+#if defined(THRESHOLD_AVX2)
+  for (; x + 8 <= w; x += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(sums + x));
+    __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + x)));
+
+    _mm256_storeu_si256((__m256i *)(sums + x), _mm256_add_epi32(s, v));
+  }
+#elif defined(THRESHOLD_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; x + 8 <= w; x += 8) {
+    __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x)), zero);
+    __m128i s0 = _mm_loadu_si128((const __m128i *)(sums + x));
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(sums + x + 4));
+
+    _mm_storeu_si128((__m128i *)(sums + x), _mm_add_epi32(s0, _mm_unpacklo_epi16(v, zero)));
+    _mm_storeu_si128((__m128i *)(sums + x + 4), _mm_add_epi32(s1, _mm_unpackhi_epi16(v, zero)));
+  }
+#else
+  for (; x + 4 <= w; x += 4) {
+    sums[x] += row[x];
+    sums[x + 1] += row[x + 1];
+    sums[x + 2] += row[x + 2];
+    sums[x + 3] += row[x + 3];
+  }
+#endif
+
+  for (; x < w; x++)
+    sums[x] += row[x];
+}
+
+static void colsum_slide(uint32_t *sums, const uint8_t *in, const uint8_t *out, int w) {
+  int x = 0;
+
+#if defined(THRESHOLD_AVX2)
+  for (; x + 8 <= w; x += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(sums + x));
+    __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + x)));
+    __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(out + x)));
+
+    _mm256_storeu_si256((__m256i *)(sums + x), _mm256_sub_epi32(_mm256_add_epi32(s, a), b));
+  }
+#elif defined(THRESHOLD_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; x + 8 <= w; x += 8) {
+    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in + x)), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(out + x)), zero);
+    __m128i s0 = _mm_loadu_si128((const __m128i *)(sums + x));
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(sums + x + 4));
+
+    s0 = _mm_sub_epi32(_mm_add_epi32(s0, _mm_unpacklo_epi16(a, zero)), _mm_unpacklo_epi16(b, zero));
+    s1 = _mm_sub_epi32(_mm_add_epi32(s1, _mm_unpackhi_epi16(a, zero)), _mm_unpackhi_epi16(b, zero));
+    _mm_storeu_si128((__m128i *)(sums + x), s0);
+    _mm_storeu_si128((__m128i *)(sums + x + 4), s1);
+  }
+#else
+  for (; x + 4 <= w; x += 4) {
+    sums[x] += in[x] - out[x];
+    sums[x + 1] += in[x + 1] - out[x + 1];
+    sums[x + 2] += in[x + 2] - out[x + 2];
+    sums[x + 3] += in[x + 3] - out[x + 3];
+  }
+#endif
+
+  for (; x < w; x++)
+    sums[x] += in[x] - out[x];
+}
+
+/* Compare src[x] against scale * (prefix[x + win] - prefix[x]) for
+ * x in [x0, x1), writing the result to dst[x + r]. The scalar and
+ * vector paths perform the same single-precision operations, so they
+ * give identical results.
+ */
+static void box_compare(quirc_pixel_t *dst, const uint8_t *src, const uint32_t *prefix, int win, float scale, int x0,
+                        int x1) {
+  const int r = win / 2;
+  int x = x0;
+
+#if defined(THRESHOLD_AVX2)
+  const __m256 vscale = _mm256_set1_ps(scale);
+
+  for (; x + 16 <= x1; x += 16) {
+    __m256i s0 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(prefix + x + win)),
+                                  _mm256_loadu_si256((const __m256i *)(prefix + x)));
+    __m256i s1 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(prefix + x + 8 + win)),
+                                  _mm256_loadu_si256((const __m256i *)(prefix + x + 8)));
+    __m256 p0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + x + r))));
+    __m256 p1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + x + r + 8))));
+    __m256i b0 = _mm256_castps_si256(_mm256_cmp_ps(p0, _mm256_mul_ps(_mm256_cvtepi32_ps(s0), vscale), _CMP_LT_OQ));
+    __m256i b1 = _mm256_castps_si256(_mm256_cmp_ps(p1, _mm256_mul_ps(_mm256_cvtepi32_ps(s1), vscale), _CMP_LT_OQ));
+    __m256i h = _mm256_permute4x64_epi64(_mm256_packs_epi32(b0, b1), 0xd8);
+    __m128i bytes = _mm_packs_epi16(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1));
+
+    _mm_storeu_si128((__m128i *)(dst + x + r), _mm_and_si128(bytes, _mm_set1_epi8(QUIRC_PIXEL_BLACK)));
+  }
+#elif defined(THRESHOLD_SSE2)
+  const __m128 vscale = _mm_set1_ps(scale);
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; x + 16 <= x1; x += 16) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(src + x + r));
+    __m128i plo = _mm_unpacklo_epi8(p, zero);
+    __m128i phi = _mm_unpackhi_epi8(p, zero);
+    __m128i b[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+      __m128i s = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(prefix + x + i * 4 + win)),
+                                _mm_loadu_si128((const __m128i *)(prefix + x + i * 4)));
+      __m128i half = (i < 2) ? plo : phi;
+      __m128i pv = (i & 1) ? _mm_unpackhi_epi16(half, zero) : _mm_unpacklo_epi16(half, zero);
+
+      b[i] = _mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(pv), _mm_mul_ps(_mm_cvtepi32_ps(s), vscale)));
+    }
+
+    p = _mm_packs_epi16(_mm_packs_epi32(b[0], b[1]), _mm_packs_epi32(b[2], b[3]));
+    _mm_storeu_si128((__m128i *)(dst + x + r), _mm_and_si128(p, _mm_set1_epi8(QUIRC_PIXEL_BLACK)));
+  }
+#endif
+
+  for (; x < x1; x++) {
+    float t = (float)(prefix[x + win] - prefix[x]) * scale;
+
+    dst[x + r] = ((float)src[x + r] < t) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+  }
+}
+
+/* Border pixels whose window is clamped to the image edge share the sum
+ * of the outermost window.
+ */
+static void box_compare_edge(quirc_pixel_t *dst, const uint8_t *src, uint32_t sum, float scale, int x0, int x1) {
+  const float t = (float)sum * scale;
+  int x;
+
+  for (x = x0; x < x1; x++)
+    dst[x] = ((float)src[x] < t) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+}
+
+void quirc_threshold_box(struct quirc *q) {
+  const int w = q->w;
+  const int h = q->h;
+  const int win = quirc_box_window(q);
+  const int r = win / 2;
+  const float scale = (float)(100 - BOX_T) / (100.0f * win * win);
+  uint32_t *sums = q->box_sums;
+  uint32_t *prefix = q->box_sums + w;
+  int top = 0;
+  int x, y;
+
+  memset(sums, 0, sizeof(*sums) * w);
+  for (y = 0; y < win; y++)
+    colsum_add(sums, quirc_source_row(q, y), w);
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *src = quirc_source_row(q, y);
+    quirc_pixel_t *row = q->pixels + y * w;
+    int want = y - r;
+
+    if (want > h - win)
+      want = h - win;
+    while (top < want) {
+      colsum_slide(sums, quirc_source_row(q, top + win), quirc_source_row(q, top), w);
+      top++;
+    }
+
+    prefix[0] = 0;
+    for (x = 0; x < w; x++)
+      prefix[x + 1] = prefix[x] + sums[x];
+
+    box_compare_edge(row, src, prefix[win], scale, 0, r);
+    box_compare(row, src, prefix, win, scale, 0, w - win + 1);
+    box_compare_edge(row, src, prefix[w] - prefix[w - win], scale, w - win + 1 + r, w);
+
+    if (q->binary)
+      pack_row(row, q->binary + y * q->binary_stride, w);
+  }
+}
+
+/************************************************************************
+ * Global Otsu thresholding
+ */
+
+static int otsu_level(const uint32_t *hist, uint32_t total) {
+  uint64_t sum_all = 0;
+  uint64_t sum_b = 0;
+  uint32_t w_b = 0;
+  double best = -1.0;
+  int level = 0;
+  int i;
+
+  for (i = 0; i < 256; i++)
+    sum_all += (uint64_t)i * hist[i];
+
+  for (i = 0; i < 256; i++) {
+    uint32_t w_f;
+    double m_b, m_f, between;
+
+    w_b += hist[i];
+    if (!w_b)
+      continue;
+
+    w_f = total - w_b;
+    if (!w_f)
+      break;
+
+    sum_b += (uint64_t)i * hist[i];
+    m_b = (double)sum_b / w_b;
+    m_f = (double)(sum_all - sum_b) / w_f;
+    between = (double)w_b * w_f * (m_b - m_f) * (m_b - m_f);
+
+    if (between > best) {
+      best = between;
+      level = i;
+    }
+  }
+
+  /* Pixels at or below the level are black */
+  return level + 1;
+}
+
+static void otsu_compare(quirc_pixel_t *dst, const uint8_t *src, int level, int w) {
+  int x = 0;
+
+#if defined(THRESHOLD_AVX2) || defined(THRESHOLD_SSE2)
+  /* Unsigned compare by flipping the sign bit */
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  const __m128i t = _mm_set1_epi8((char)(level ^ 0x80));
+
+  if (level <= 255) {
+    for (; x + 16 <= w; x += 16) {
+      __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + x)), bias);
+      __m128i b = _mm_cmplt_epi8(v, t);
+
+      _mm_storeu_si128((__m128i *)(dst + x), _mm_and_si128(b, _mm_set1_epi8(QUIRC_PIXEL_BLACK)));
+    }
+  }
+#else
+  for (; x + 4 <= w; x += 4) {
+    dst[x] = (src[x] < level) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+    dst[x + 1] = (src[x + 1] < level) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+    dst[x + 2] = (src[x + 2] < level) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+    dst[x + 3] = (src[x + 3] < level) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+  }
+#endif
+
+  for (; x < w; x++)
+    dst[x] = (src[x] < level) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+}
+
+void quirc_threshold_otsu(struct quirc *q) {
+  uint32_t hist[256];
+  int level;
+  int x, y;
+
+  memset(hist, 0, sizeof(hist));
+  for (y = 0; y < q->h; y++) {
+    const uint8_t *src = quirc_source_row(q, y);
+
+    for (x = 0; x < q->w; x++)
+      hist[src[x]]++;
+  }
+
+  level = otsu_level(hist, q->w * q->h);
+
+  for (y = 0; y < q->h; y++) {
+    quirc_pixel_t *row = q->pixels + y * q->w;
+
+    otsu_compare(row, quirc_source_row(q, y), level, q->w);
+
+    if (q->binary)
+      pack_row(row, q->binary + y * q->binary_stride, q->w);
+  }
+}
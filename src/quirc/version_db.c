@@ -104,7 +104,7 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
      .ecc = {{.bs = 67, .dw = 41, .ns = 3}, {.bs = 135, .dw = 107, .ns = 3}, {.bs = 43, .dw = 15, .ns = 15}, {.bs = 54, .dw = 24, .ns = 15}}},
     {/* Version 21 */
      .data_bytes = 1156,
-     .apat = {6, 28, 50, 72, 92, 0},
+     .apat = {6, 28, 50, 72, 94, 0},
      .ecc = {{.bs = 68, .dw = 42, .ns = 17}, {.bs = 144, .dw = 116, .ns = 4}, {.bs = 46, .dw = 16, .ns = 19}, {.bs = 50, .dw = 22, .ns = 17}}},
     {/* Version 22 */
      .data_bytes = 1258,